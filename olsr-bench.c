@@ -0,0 +1,303 @@
+#include "ross.h"
+#include "olsr.h"
+#include <assert.h>
+#include <time.h>
+
+/**
+ * @file
+ * @brief Microbenchmarks for the per-node OLSR kernels
+ *
+ * Builds node_state instances for a few synthetic region topologies and
+ * times the kernels on them directly, without starting ROSS.  Node 0 of
+ * the region is the node doing the work; its neighbor and 2-hop sets are
+ * what it would have learned from everyone's HELLOs, and its topology set
+ * holds a TC from every other node.
+ *
+ * Each kernel is repeated until it has run for at least BENCH_MIN_NS and
+ * reported in ns per call and in items (routes, neighbors, tuples) per
+ * second.
+ */
+
+#define BENCH_MIN_NS 200000000ull
+
+typedef enum {
+    SHAPE_SPARSE,   ///< A ring plus an edge from each node to a random other
+    SHAPE_DENSE,    ///< Each pair linked with probability 0.6
+    SHAPE_LINE,     ///< Node i linked to i - 1 and i + 1
+    SHAPE_CLIQUE,   ///< Everyone linked to everyone
+    SHAPES,
+} bench_shape;
+
+static const char *shape_names[SHAPES] = {
+    "sparse",
+    "dense",
+    "line",
+    "clique",
+};
+
+static olsr_mpr_scratch scratch;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/** Small fixed LCG so every run benchmarks the same graphs */
+static unsigned bench_rand(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 16) & 0x7fff;
+}
+
+/**
+ * Fill adj with a symmetric adjacency mask per node of the region
+ */
+static void make_graph(bench_shape shape, olsr_mask adj[OLSR_MAX_NEIGHBORS])
+{
+    int i, j;
+    unsigned seed = 1;
+    const int n = OLSR_MAX_NEIGHBORS;
+
+    memset(adj, 0, sizeof(olsr_mask) * n);
+
+    for (i = 0; i < n; i++) {
+        for (j = i + 1; j < n; j++) {
+            int link = 0;
+
+            switch (shape) {
+                case SHAPE_SPARSE:
+                    link = (j == i + 1) || (i == 0 && j == n - 1);
+                    break;
+                case SHAPE_DENSE:
+                    link = bench_rand(&seed) % 10 < 6;
+                    break;
+                case SHAPE_LINE:
+                    link = (j == i + 1);
+                    break;
+                default:
+                    link = 1;
+                    break;
+            }
+
+            if (link) {
+                adj[i] |= OLSR_MASK_BIT(j);
+                adj[j] |= OLSR_MASK_BIT(i);
+            }
+        }
+    }
+
+    if (shape == SHAPE_SPARSE) {
+        for (i = 0; i < n; i++) {
+            do {
+                j = bench_rand(&seed) % n;
+            } while (j == i);
+            adj[i] |= OLSR_MASK_BIT(j);
+            adj[j] |= OLSR_MASK_BIT(i);
+        }
+    }
+}
+
+/**
+ * The state node 0 ends up with once it has heard a HELLO and a TC from
+ * everyone
+ */
+static void make_state(node_state *s, const olsr_mask adj[OLSR_MAX_NEIGHBORS])
+{
+    int u;
+    olsr_mask m, h;
+
+    olsr_state_clear(s);
+    s->local_address = 0;
+
+    for (m = adj[0]; m; m &= m - 1) {
+        u = olsr_ctz(m);
+        s->neighSet[s->num_neigh].neighborMainAddr = u;
+        s->neighSet[s->num_neigh].status = STATUS_SYM;
+        s->neighSet[s->num_neigh].expirationTime = NEIGHB_HOLD_TIME;
+        s->num_neigh++;
+        s->neigh_mask |= OLSR_MASK_BIT(u);
+
+        // Everything u hears except us, as HELLO_RX records it
+        s->two_hop_mask[u] = adj[u] & ~OLSR_MASK_BIT(0);
+        for (h = s->two_hop_mask[u]; h; h &= h - 1) {
+            s->twoHopSet.neighborMainAddr[s->num_two_hop] = u;
+            s->twoHopSet.twoHopNeighborAddr[s->num_two_hop] = olsr_ctz(h);
+            s->twoHopSet.expirationTime[s->num_two_hop] = NEIGHB_HOLD_TIME;
+            s->num_two_hop++;
+        }
+    }
+
+    for (u = 1; u < OLSR_MAX_NEIGHBORS; u++) {
+        s->topSet.destAddr[u] = adj[u];
+        s->topSet.sequenceNumber[u] = 1;
+        s->topSet.expirationTime[u] = TOP_HOLD_TIME;
+    }
+}
+
+static void report(const char *kernel, bench_shape shape,
+                   unsigned long long ns, unsigned long long ops,
+                   unsigned long long items)
+{
+    printf("%-24s %-8s %12.1f ns/op %14.0f items/s\n",
+           kernel, shape_names[shape],
+           (double)ns / ops, ns ? items * 1e9 / ns : 0.0);
+}
+
+/*
+ * Each bench_* runs its kernel in batches, doubling the batch until the
+ * time adds up to BENCH_MIN_NS, and reports the total.
+ */
+
+static void bench_routes(node_state *s, bench_shape shape)
+{
+    unsigned long long ops = 0, items = 0, start, ns = 0;
+    unsigned long batch, k;
+
+    for (batch = 1; ns < BENCH_MIN_NS; batch *= 2) {
+        start = now_ns();
+        for (k = 0; k < batch; k++) {
+            RoutingTableComputation(s);
+        }
+        ns += now_ns() - start;
+        ops += batch;
+        items += batch * olsr_popcount(s->route_valid);
+    }
+
+    report("RoutingTableComputation", shape, ns, ops, items);
+}
+
+static void bench_mpr(node_state *s, bench_shape shape)
+{
+    unsigned long long ops = 0, items = 0, start, ns = 0;
+    unsigned long batch, k;
+
+    for (batch = 1; ns < BENCH_MIN_NS; batch *= 2) {
+        start = now_ns();
+        for (k = 0; k < batch; k++) {
+            MprComputation(s, &scratch);
+        }
+        ns += now_ns() - start;
+        ops += batch;
+        items += batch * s->num_neigh;
+    }
+
+    report("MprComputation", shape, ns, ops, items);
+}
+
+static void bench_dy(node_state *s, bench_shape shape)
+{
+    unsigned long long ops = 0, start, ns = 0;
+    unsigned long batch, k;
+    volatile unsigned sink = 0;
+    int i;
+
+    if (s->num_neigh == 0) return;
+
+    for (batch = 1; ns < BENCH_MIN_NS; batch *= 2) {
+        start = now_ns();
+        for (k = 0; k < batch; k++) {
+            for (i = 0; i < s->num_neigh; i++) {
+                sink += Dy(s, s->neighSet[i].neighborMainAddr);
+            }
+        }
+        ns += now_ns() - start;
+        ops += batch * s->num_neigh;
+    }
+
+    report("Dy", shape, ns, ops, ops);
+}
+
+/**
+ * One op is an AddDuplicate() of a new (originator, sequence number) and a
+ * FindDuplicateTuple() of it.  The clock moves on half a second per op,
+ * so about 60 tuples are live and they leave by expiring.
+ */
+static void bench_dups(node_state *s, bench_shape shape)
+{
+    unsigned long long ops = 0, start, ns = 0;
+    unsigned long batch, k;
+    Time now = 0;
+    uint16_t seq = 0;
+    o_local orig;
+
+    for (batch = 1; ns < BENCH_MIN_NS; batch *= 2) {
+        start = now_ns();
+        for (k = 0; k < batch; k++, seq++) {
+            orig = seq % OLSR_MAX_NEIGHBORS;
+            now += 0.5;
+            AddDuplicate(orig, seq, now + OLSR_DUP_HOLD_TIME, 0, s, now);
+            if (FindDuplicateTuple(orig, seq, s) == NULL) {
+                tw_error(TW_LOC, "Lost duplicate tuple %u/%u\n", orig, seq);
+            }
+        }
+        ns += now_ns() - start;
+        ops += batch;
+    }
+
+    report("AddDuplicate+Find", shape, ns, ops, ops);
+}
+
+/**
+ * One op erases a row with an older ANSN and puts it back, so there is
+ * always something to erase.
+ */
+static void bench_erase(node_state *s, bench_shape shape)
+{
+    unsigned long long ops = 0, items = 0, start, ns = 0;
+    unsigned long batch, k;
+    o_local last;
+    olsr_mask row[OLSR_MAX_NEIGHBORS];
+
+    memcpy(row, s->topSet.destAddr, sizeof(row));
+
+    for (batch = 1; ns < BENCH_MIN_NS; batch *= 2) {
+        start = now_ns();
+        for (k = 0; k < batch; k++) {
+            last = 1 + k % (OLSR_MAX_NEIGHBORS - 1);
+            EraseOlderTopologyTuples(last, 2, s);
+            s->topSet.destAddr[last] = row[last];
+        }
+        ns += now_ns() - start;
+        ops += batch;
+    }
+
+    for (last = 1; last < OLSR_MAX_NEIGHBORS; last++) {
+        items += olsr_popcount(row[last]);
+    }
+
+    // Tuples erased per second, averaged over the rows
+    report("EraseOlderTopology", shape, ns, ops,
+           ops * items / (OLSR_MAX_NEIGHBORS - 1));
+}
+
+int main(int argc, char *argv[])
+{
+    int shape;
+    olsr_mask adj[OLSR_MAX_NEIGHBORS];
+    node_state *s = calloc(1, sizeof(node_state));
+
+    if (s == NULL) {
+        fprintf(stderr, "Failed to allocate node_state\n");
+        return 1;
+    }
+
+    printf("OLSR kernels, %d nodes per region, node_state is %lu bytes\n",
+           OLSR_MAX_NEIGHBORS, sizeof(node_state));
+
+    for (shape = 0; shape < SHAPES; shape++) {
+        make_graph(shape, adj);
+        make_state(s, adj);
+
+        bench_routes(s, shape);
+        bench_mpr(s, shape);
+        bench_dy(s, shape);
+        bench_erase(s, shape);
+        bench_dups(s, shape);
+    }
+
+    free(s);
+    return 0;
+}
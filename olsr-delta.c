@@ -0,0 +1,229 @@
+#include "ross.h"
+#include "olsr.h"
+#include <assert.h>
+
+/**
+ * @file
+ * @brief Delta state saving for optimistic runs
+ *
+ * Before a forward event overwrites part of node_state it copies the old
+ * bytes into its LP's delta log; rolling the event back copies them back,
+ * newest first.  Each event's entries form one segment, opened on the first
+ * save so events that change nothing cost nothing.  Segments from before
+ * GVT are dropped whenever a new one is opened, which is when ROSS would
+ * have fossil collected the events that wrote them.
+ *
+ * Positions handed out to messages are logical (buf[0] is at "base"), so
+ * the live part of the buffer can be slid down without invalidating them.
+ */
+
+#define DELTA_NONE ((unsigned long)-1)
+#define DELTA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#define DELTA_INITIAL_SIZE 4096
+
+/// Start of each event's entries
+typedef struct
+{
+    tw_stime ts;        ///< Timestamp of the event that wrote this segment
+    unsigned long prev; ///< Position of the previous segment
+    size_t len;         ///< Bytes of entries following this header
+} delta_segment;
+
+/// Trailer of each saved range; the saved bytes come just before it
+typedef struct
+{
+    uint32_t offset;    ///< Offset of the range within node_state
+    uint32_t len;       ///< Length of the range
+} delta_entry;
+
+struct olsr_delta_log
+{
+    char *buf;
+    size_t size;
+    /// Oldest segment still needed
+    size_t tail;
+    /// End of the newest entry
+    size_t head;
+    /// Position of buf[0]
+    unsigned long base;
+    /// Position of the newest segment, DELTA_NONE if there is none
+    unsigned long last;
+    /// Event that has not saved anything yet, and its timestamp
+    olsr_msg_data *pending;
+    tw_stime pending_ts;
+    /// GVT when the pending event started
+    tw_stime gvt;
+};
+
+olsr_delta_log * olsr_delta_new(void)
+{
+    olsr_delta_log *d = calloc(1, sizeof(olsr_delta_log));
+
+    if (d == NULL)
+        tw_error(TW_LOC, "Failed to allocate delta log\n");
+
+    d->size = DELTA_INITIAL_SIZE;
+    d->buf = malloc(d->size);
+    if (d->buf == NULL)
+        tw_error(TW_LOC, "Failed to allocate delta log\n");
+    d->last = DELTA_NONE;
+
+    return d;
+}
+
+static inline delta_segment * segment_at(olsr_delta_log *d, unsigned long pos)
+{
+    return (delta_segment *)(d->buf + (pos - d->base));
+}
+
+/**
+ * Make room for need more bytes at head, sliding the live part of the
+ * buffer down first if that frees enough.
+ */
+static void delta_reserve(olsr_delta_log *d, size_t need)
+{
+    if (d->head + need <= d->size) return;
+
+    if (d->tail > 0) {
+        memmove(d->buf, d->buf + d->tail, d->head - d->tail);
+        d->base += d->tail;
+        d->head -= d->tail;
+        d->tail = 0;
+    }
+
+    while (d->head + need > d->size) {
+        d->size *= 2;
+    }
+
+    d->buf = realloc(d->buf, d->size);
+    if (d->buf == NULL)
+        tw_error(TW_LOC, "Failed to grow delta log to %lu bytes\n", d->size);
+}
+
+/**
+ * Open a segment for the pending event: close the previous one, drop
+ * whatever is older than GVT and write the new header.
+ */
+static void delta_open(olsr_delta_log *d)
+{
+    delta_segment *seg;
+
+    if (d->last != DELTA_NONE) {
+        seg = segment_at(d, d->last);
+        seg->len = d->base + d->head - d->last - sizeof(delta_segment);
+    }
+
+    while (d->tail < d->head) {
+        seg = (delta_segment *)(d->buf + d->tail);
+        if (seg->ts >= d->gvt) break;
+        d->tail += sizeof(delta_segment) + seg->len;
+    }
+
+    if (d->tail == d->head) {
+        // Everything committed, start over at the bottom of the buffer
+        d->base += d->tail;
+        d->head = d->tail = 0;
+        d->last = DELTA_NONE;
+    }
+
+    delta_reserve(d, sizeof(delta_segment));
+
+    seg = (delta_segment *)(d->buf + d->head);
+    seg->ts = d->pending_ts;
+    seg->prev = d->last;
+    seg->len = 0;
+
+    d->last = d->base + d->head;
+    d->head += sizeof(delta_segment);
+    d->pending->delta = d->last;
+    d->pending = NULL;
+
+    g_olsr_stats.delta_bytes += sizeof(delta_segment);
+    g_olsr_stats.delta_segments++;
+}
+
+/**
+ * Called at the top of every forward event.  Nothing is written until the
+ * event saves something.
+ */
+void olsr_delta_begin(node_state *s, olsr_msg_data *m, tw_lp *lp)
+{
+    olsr_delta_log *d = s->delta;
+
+    if (d == NULL) return;
+
+    m->delta = DELTA_NONE;
+    d->pending = m;
+    d->pending_ts = tw_now(lp);
+    d->gvt = lp->pe->GVT;
+}
+
+/**
+ * Log the len bytes at field, which must lie inside s, before they are
+ * overwritten.
+ */
+void olsr_delta_save(node_state *s, void *field, size_t len)
+{
+    olsr_delta_log *d = s->delta;
+    delta_entry *ent;
+    size_t need;
+
+    if (d == NULL) return;
+
+    assert((char *)field >= (char *)s);
+    assert((char *)field + len <= (char *)(s + 1));
+
+    if (d->pending) {
+        delta_open(d);
+    }
+
+    need = DELTA_ALIGN(len) + sizeof(delta_entry);
+    delta_reserve(d, need);
+
+    memcpy(d->buf + d->head, field, len);
+    ent = (delta_entry *)(d->buf + d->head + DELTA_ALIGN(len));
+    ent->offset = (char *)field - (char *)s;
+    ent->len = len;
+    d->head += need;
+
+    g_olsr_stats.delta_bytes += need;
+}
+
+/**
+ * Put back everything the event that carried m saved.  Events are rolled
+ * back newest first, so its segment is always the last one in the log.
+ */
+void olsr_delta_rollback(node_state *s, olsr_msg_data *m)
+{
+    olsr_delta_log *d = s->delta;
+    delta_entry *ent;
+    delta_segment *seg;
+    size_t start;
+
+    if (d == NULL) return;
+
+    if (d->pending == m) {
+        d->pending = NULL;
+    }
+
+    if (m->delta == DELTA_NONE) return;
+
+    assert(m->delta == d->last);
+
+    start = m->delta - d->base;
+
+    while (d->head > start + sizeof(delta_segment)) {
+        ent = (delta_entry *)(d->buf + d->head - sizeof(delta_entry));
+        d->head -= sizeof(delta_entry) + DELTA_ALIGN(ent->len);
+        memcpy((char *)s + ent->offset, d->buf + d->head, ent->len);
+    }
+
+    seg = segment_at(d, m->delta);
+    d->last = seg->prev;
+    d->head = start;
+
+    // The previous segment may already have been dropped as committed
+    if (d->last != DELTA_NONE && d->last < d->base + d->tail) {
+        d->last = DELTA_NONE;
+    }
+}
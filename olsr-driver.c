@@ -13,6 +13,7 @@ double g_X[OLSR_MAX_NEIGHBORS];
 double g_Y[OLSR_MAX_NEIGHBORS];
 
 #define GRID_MAX 100
+#define RANGE 60.0
 #define STAGGER_MAX 10
 #define HELLO_DELTA 0.0001
 #define OLSR_NO_FINAL_OUTPUT 1
@@ -23,20 +24,17 @@ double g_Y[OLSR_MAX_NEIGHBORS];
 
 unsigned int nlp_per_pe = OLSR_MAX_NEIGHBORS;
 
-// Used as scratch space for MPR calculations
-unsigned g_Dy[OLSR_MAX_NEIGHBORS];
-unsigned g_num_one_hop;
-neigh_tuple g_mpr_one_hop[OLSR_MAX_NEIGHBORS];
-unsigned g_num_two_hop;
-two_hop_neigh_tuple g_mpr_two_hop[OLSR_MAX_2_HOP];
-unsigned g_reachability[OLSR_MAX_NEIGHBORS];
-neigh_tuple g_mpr_neigh_to_add;
-unsigned g_mpr_num_add_nodes;
-char g_covered[BITNSLOTS(OLSR_MAX_NEIGHBORS)];
-char g_olsr_mobility = 'N';
-
-unsigned long long g_olsr_event_stats[OLSR_END_EVENT];
-unsigned long long g_olsr_root_event_stats[OLSR_END_EVENT];
+/**
+ * MPR scratch space for this PE.  MprComputation() itself only touches
+ * what it is handed, so any other caller (olsr-bench.c) brings its own.
+ */
+static olsr_mpr_scratch g_mpr_scratch;
+/** --rwalk=Y/N.  Only the first character counts, see olsr-main.c */
+char g_olsr_mobility[OLSR_OPT_LEN] = "N";
+/** --fanout=1 */
+unsigned int g_olsr_fanout = 0;
+
+olsr_stats g_olsr_stats;
 
 char *event_names[OLSR_END_EVENT] = {
     "HELLO_RX",
@@ -50,7 +48,17 @@ char *event_names[OLSR_END_EVENT] = {
     "RWALK_CHANGE"
 };
 
-FILE *olsr_event_log=NULL;
+/**
+ * tw_event_send() for every message the model sends.  Stamps the sending
+ * rank so the receiver can tell a local delivery from a remote one.
+ */
+static inline void olsr_event_send(tw_event *e)
+{
+    olsr_msg_data *m = tw_event_data(e);
+    
+    m->src_rank = g_tw_mynode;
+    tw_event_send(e);
+}
 
 unsigned region(o_addr a)
 {
@@ -103,37 +111,177 @@ o_addr master_hierarchy(o_addr lpid, int level)
     return lpid;
 }
 
+/** Cells per side of a region grid; each cell is RANGE wide */
+#define GRID_CELLS ((GRID_MAX + (int)RANGE - 1) / (int)RANGE)
+
 /**
- * Initializer for OLSR
+ * Uniform grid of the node positions in one region.  Anything within RANGE
+ * of a point lies in that point's cell or one of the eight around it, so
+ * the receivers of a transmission can be listed without visiting every
+ * node in the region.
  */
-void olsr_init(node_state *s, tw_lp *lp)
+typedef struct
 {
-    hello *h;
-    TC *t;
-    tw_event *e;
-    olsr_msg_data *msg;
-    tw_stime ts;
-    int i;
+    double lng[OLSR_MAX_NEIGHBORS];
+    double lat[OLSR_MAX_NEIGHBORS];
+    /// Cell each node is currently filed under
+    unsigned char cell[OLSR_MAX_NEIGHBORS];
+    /// Nodes in each cell
+    olsr_mask members[GRID_CELLS * GRID_CELLS];
+} region_grid;
 
-#if DEBUG
-    fprintf( olsr_event_log, "OLSR Init LP %d RNG Seeds Are: ", lp->gid);
-    rng_write_state( lp->rng, olsr_event_log );
+/** One grid per region on this PE, allocated on first use */
+region_grid *g_olsr_grid;
+
+static inline int grid_coord(double v)
+{
+    int c = (int)(v / RANGE);
+    
+    if (c < 0) return 0;
+    if (c >= GRID_CELLS) return GRID_CELLS - 1;
+    return c;
+}
+
+static region_grid * grid_for(o_addr a)
+{
+    unsigned nregions = SA_range_start / OLSR_MAX_NEIGHBORS;
+    
+    assert(nregions > 0);
+    
+    if (g_olsr_grid == NULL) {
+        g_olsr_grid = calloc(nregions, sizeof(region_grid));
+        if (g_olsr_grid == NULL)
+            tw_error(TW_LOC, "Failed to allocate %u region grids\n", nregions);
+    }
+    
+    return &g_olsr_grid[region(a) % nregions];
+}
+
+/**
+ * Record that node a is now at (lng, lat).  Called at init and whenever a
+ * node moves (RWALK_CHANGE or its reverse).
+ */
+void region_grid_place(o_addr a, double lng, double lat)
+{
+    region_grid *g = grid_for(a);
+    int i = a % OLSR_MAX_NEIGHBORS;
+    int cell = grid_coord(lng) * GRID_CELLS + grid_coord(lat);
+    
+    g->members[g->cell[i]] &= ~OLSR_MASK_BIT(i);
+    g->members[cell] |= OLSR_MASK_BIT(i);
+    g->cell[i] = cell;
+    g->lng[i] = lng;
+    g->lat[i] = lat;
+}
+
+/**
+ * Nodes of sender's region that can hear a transmission made from
+ * (lng, lat), not counting the sender itself.  With USE_RADIO_DISTANCE
+ * off the cells only narrow the candidates down and the receivers still
+ * decide for themselves in out_of_radio_range().
+ */
+olsr_mask region_grid_in_range(o_addr sender, double lng, double lat)
+{
+    region_grid *g = grid_for(sender);
+    int x = grid_coord(lng);
+    int y = grid_coord(lat);
+    int i, j;
+    olsr_mask candidates = 0;
+    olsr_mask heard = 0;
+    
+    for (i = x - 1; i <= x + 1; i++) {
+        if (i < 0 || i >= GRID_CELLS) continue;
+        for (j = y - 1; j <= y + 1; j++) {
+            if (j < 0 || j >= GRID_CELLS) continue;
+            candidates |= g->members[i * GRID_CELLS + j];
+        }
+    }
+    
+    candidates &= ~OLSR_MASK_BIT(sender % OLSR_MAX_NEIGHBORS);
+    
+#if USE_RADIO_DISTANCE
+    for (i = 0; candidates; i++, candidates >>= 1) {
+        double dist;
+        
+        if (!(candidates & 1)) continue;
+        
+        // Same arithmetic as out_of_radio_range() so both sides agree
+        dist = (lng - g->lng[i]) * (lng - g->lng[i]);
+        dist += (lat - g->lat[i]) * (lat - g->lat[i]);
+        dist = sqrt(dist);
+        
+        if (dist <= RANGE) {
+            heard |= OLSR_MASK_BIT(i);
+        }
+    }
+#else
+    heard = candidates;
 #endif
+    
+    return heard;
+}
 
+/**
+ * Empty every set in s and give it no undo log.  Everything else (address,
+ * position) is left to the caller.
+ */
+void olsr_state_clear(node_state *s)
+{
+    int i;
+    
     //s->num_tuples = 0;
     s->num_neigh  = 0;
+    s->neigh_mask = 0;
     s->num_two_hop = 0;
+    memset(s->two_hop_mask, 0, sizeof(s->two_hop_mask));
     s->num_mpr = 0;
+    s->mpr_mask = 0;
+    s->mpr_dirty = 0;
     s->num_mpr_sel = 0;
-    s->num_top_set = 0;
+    memset(&s->topSet, 0, sizeof(s->topSet));
     s->num_dupes = 0;
+    for (i = 0; i < OLSR_MAX_DUPES; i++) {
+        s->dupSet[i].next = (i + 1 < OLSR_MAX_DUPES) ? i + 1 : OLSR_DUP_NONE;
+    }
+    memset(s->dup_hash, OLSR_DUP_NONE, sizeof(s->dup_hash));
+    s->dup_oldest = OLSR_DUP_NONE;
+    s->dup_free = 0;
     for (i = 0; i < OLSR_MAX_NEIGHBORS; i++) {
         s->SA_per_node[i] = 0;
     }
+    s->route_valid = 0;
+    s->routes_dirty = 0;
+    memset(s->wheel_neigh, 0, sizeof(s->wheel_neigh));
+    memset(s->wheel_two_hop, 0, sizeof(s->wheel_two_hop));
+    memset(s->wheel_top, 0, sizeof(s->wheel_top));
+    s->wheel_next = 0;
+    s->delta = NULL;
+}
+
+/**
+ * Initializer for OLSR
+ */
+void olsr_init(node_state *s, tw_lp *lp)
+{
+    hello *h;
+    TC *t;
+    tw_event *e;
+    olsr_msg_data *msg;
+    tw_stime ts;
+
+    OLSR_TRACE(lp, NULL, OLSR_TRACE_INIT);
+
+    olsr_state_clear(s);
+#if !OLSR_REVERSE
+    if (g_tw_synchronization_protocol == OPTIMISTIC) {
+        s->delta = olsr_delta_new();
+    }
+#endif
     // Now we store the GID as opposed to an int from 0-OMN
     s->local_address = lp->gid;// % OLSR_MAX_NEIGHBORS;
     s->lng = tw_rand_unif(lp->rng) * GRID_MAX;
     s->lat = tw_rand_unif(lp->rng) * GRID_MAX;
+    region_grid_place(s->local_address, s->lng, s->lat);
     // printf("Initializing node %lu on CPU %llu\n", lp->gid, lp->pe->id);
     
     //g_X[s->local_address] = s->lng;
@@ -147,8 +295,9 @@ void olsr_init(node_state *s, tw_lp *lp)
     msg->lng = s->lng;
     msg->lat = s->lat;
     h = &msg->mt.h;
-    h->num_neighbors = 0;
-    tw_event_send(e);
+    h->neighbors = 0;
+    h->mprs = 0;
+    olsr_event_send(e);
     
     // Build our initial TC_TX messages
     ts = tw_rand_unif(lp->rng) * STAGGER_MAX;
@@ -161,7 +310,7 @@ void olsr_init(node_state *s, tw_lp *lp)
     t = &msg->mt.t;
     //t->num_mpr_sel = 0;
     t->num_neighbors = 0;
-    tw_event_send(e);
+    olsr_event_send(e);
     
     // Build our initial SA_TX messages
     ts = tw_rand_unif(lp->rng) * STAGGER_MAX + SA_INTERVAL;
@@ -172,9 +321,9 @@ void olsr_init(node_state *s, tw_lp *lp)
     msg->destination = MASTER_NODE;
     msg->lng = s->lng;
     msg->lat = s->lat;
-    tw_event_send(e);
+    olsr_event_send(e);
     
-    if (g_olsr_mobility != 'n' && g_olsr_mobility != 'N') {
+    if (g_olsr_mobility[0] != 'n' && g_olsr_mobility[0] != 'N') {
         // Build our initial RWALK_CHANGE messages
         ts = tw_rand_unif(lp->rng) * RWALK_INTERVAL + 1.0;
         e = tw_event_new(lp->gid, ts, lp);
@@ -182,7 +331,7 @@ void olsr_init(node_state *s, tw_lp *lp)
         msg->type = RWALK_CHANGE;
         msg->lng = tw_rand_unif(lp->rng) * GRID_MAX;
         msg->lat = tw_rand_unif(lp->rng) * GRID_MAX;
-        tw_event_send(e);
+        olsr_event_send(e);
     }
     
 #if 1 /* Source of instability if done naively */
@@ -198,17 +347,14 @@ void olsr_init(node_state *s, tw_lp *lp)
         msg->destination = sa_master_for_level(lp->gid);
         msg->lng = s->lng;
         msg->lat = s->lat;
-        tw_event_send(e);
+        olsr_event_send(e);
     }
 #endif
 }
 
 void sa_master_init(node_state *s, tw_lp *lp)
 {
-#if DEBUG
-  fprintf( olsr_event_log, "SA Master Init LP %d RNG Seeds Are: ", lp->gid);
-  rng_write_state( lp->rng, olsr_event_log );
-#endif
+    OLSR_TRACE(lp, NULL, OLSR_TRACE_INIT);
     
     s->local_address = lp->gid;
     //printf("I am an SA master and my local_address is %lu\n", s->local_address);    
@@ -282,9 +428,10 @@ DoCalcRxPower (double txPowerDbm,
     return txPowerDbm + pr;
 }
 
-#define RANGE 60.0
-
-static inline int out_of_radio_range(node_state *s, olsr_msg_data *m)
+/**
+ * Is receiver s too far from the sender of m to hear it?
+ */
+int out_of_radio_range(node_state *s, olsr_msg_data *m)
 {
 #if USE_RADIO_DISTANCE
     const double range = RANGE;
@@ -318,180 +465,159 @@ static inline int out_of_radio_range(node_state *s, olsr_msg_data *m)
 }
 
 /**
- * Compute D(y) as described in the "MPR Computation" section.  Description:
- *
- * The degree of an one hop neighbor node y (where y is a member of N), is
- * defined as the number of symmetric neighbors of node y, EXCLUDING all the
- * members of N and EXCLUDING the node performing the computation.
+ * Are broadcasts delivered directly to each receiver (fan-out) rather than
+ * passed along the region one LP at a time (chain)?
+ */
+static inline int olsr_fanout(void)
+{
+    return g_olsr_fanout != 0;
+}
+
+/**
+ * Broadcast "out" from node s to the rest of its region.
  *
- * N is the subset of neighbors of the node, which are neighbors of the
- * interface I.
+ * In chain mode the message is handed to the first LP of the region, and
+ * each receiver passes a copy on to m->target + 1 until the region is
+ * exhausted.  In fan-out mode the sender looks up the receivers that are
+ * within radio range right now in the region grid and schedules one event
+ * for each, all at the same timestamp.
  */
-static inline unsigned Dy(node_state *s, o_addr target)
+static void olsr_broadcast(node_state *s, olsr_msg_data *out, tw_lp *lp)
 {
-    int i, j, in;
-    o_addr temp[OLSR_MAX_NEIGHBORS];
-    int temp_size = 0;
+    int i;
+    tw_event *e;
+    tw_stime ts;
+    tw_lp *cur_lp;
+    olsr_msg_data *msg;
+    olsr_mask heard;
+    o_addr base = region(s->local_address) * OLSR_MAX_NEIGHBORS;
     
-    for (i = 0; i < s->num_two_hop; i++) {
+    ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
+    
+    if (!olsr_fanout()) {
+        cur_lp = tw_getlocal_lp(base);
         
-        in = 0;
-        for (j = 0; j < s->num_neigh; j++) {
-            if (s->twoHopSet[i].twoHopNeighborAddr == s->neighSet[j].neighborMainAddr) {
-                // EXCLUDING all members of N...
-                in = 1;
-                continue;
-            }
+        e = tw_event_new(cur_lp->gid, ts, lp);
+        msg = tw_event_data(e);
+        memcpy(msg, out, sizeof(olsr_msg_data));
+        msg->target = cur_lp->gid;
+        olsr_event_send(e);
+        return;
+    }
+    
+    heard = region_grid_in_range(s->local_address, out->lng, out->lat);
+    
+    for (i = 0; heard; i++, heard >>= 1) {
+        if (!(heard & 1)) {
+            continue;
         }
         
-        if (in) continue;
+        cur_lp = tw_getlocal_lp(base + i);
         
-        if (s->twoHopSet[i].neighborMainAddr == target) {
-            in = 0;
-            // Add s->twoHopSet[i].twoHopNeighborAddr to this set
-            for (j = 0; j < temp_size; j++) {
-                if (temp[j] == s->twoHopSet[i].twoHopNeighborAddr) {
-                    in = 1;
-                }
-            }
-            
-            if (!in) {
-                temp[temp_size] = s->twoHopSet[i].twoHopNeighborAddr;
-                temp_size++;
-                assert(temp_size < OLSR_MAX_NEIGHBORS);
-            }
-        }
+        e = tw_event_new(cur_lp->gid, ts, lp);
+        msg = tw_event_data(e);
+        memcpy(msg, out, sizeof(olsr_msg_data));
+        msg->target = cur_lp->gid;
+        olsr_event_send(e);
     }
-    
-    return temp_size;
 }
 
 /**
- * Remove "n" from N2 (stored in g_mpr_two_hop)
+ * Note that the neighbor or 2-hop set changed.  The MPR set is only ever
+ * read when we advertise it, so it is rebuilt then (mpr_current()) and
+ * every HELLO heard in between shares one computation.
  */
-static inline void remove_node_from_n2(o_addr n)
+static inline void mpr_changed(node_state *s)
 {
-    int i;
-    int index_to_remove;
-    
-    while (1) {
-        index_to_remove = -1;
-        for (i = 0; i < g_num_two_hop; i++) {
-            if (g_mpr_two_hop[i].twoHopNeighborAddr == n) {
-                index_to_remove = i;
-                break;
-            }
-        }
-        
-        if (index_to_remove == -1) break;
-        
-        //printf("Removing %d\n", index_to_remove);
-        g_mpr_two_hop[index_to_remove].expirationTime = g_mpr_two_hop[g_num_two_hop-1].expirationTime;
-        g_mpr_two_hop[index_to_remove].neighborMainAddr = g_mpr_two_hop[g_num_two_hop-1].neighborMainAddr;
-        g_mpr_two_hop[index_to_remove].twoHopNeighborAddr = g_mpr_two_hop[g_num_two_hop-1].twoHopNeighborAddr;
-        g_num_two_hop--;
+    if (!s->mpr_dirty) {
+        OLSR_SAVE(s, s->mpr_dirty);
+        s->mpr_dirty = 1;
     }
 }
 
 /**
- * Ensure that all nodes in MPR set are unique (hence "set")
+ * Note that the neighbor, 2-hop or topology set changed.  The routing
+ * table is rebuilt the next time Lookup() needs it.
  */
-void mpr_set_uniq(node_state *s)
+static inline void routes_changed(node_state *s)
 {
-    int i;
-    
-    // Presumably if we just added a MPR, we only need to check all the
-    // others against the last one
-    o_addr last = s->mprSet[s->num_mpr-1];
-    
-    for (i = 0; i < s->num_mpr - 1; i++) {
-        if (s->mprSet[i] == last) {
-            s->num_mpr--;
-            return;
-        }
+    if (!s->routes_dirty) {
+        OLSR_SAVE(s, s->routes_dirty);
+        s->routes_dirty = 1;
     }
 }
 
 /**
- * Ensure that all nodes in MPR selector set are unique (hence "set")
+ * Ensure that all nodes in MPR selector set are unique (hence "set").
+ * Returns 1 if the selector just added was new.
  */
-void mpr_sel_set_uniq(node_state *s)
+int mpr_sel_set_uniq(node_state *s)
 {
     int i;
     
     // Presumably if we just added a MPR, we only need to check all the
     // others against the last one
-    o_addr last = s->mprSelSet[s->num_mpr_sel-1].mainAddr;
+    o_local last = s->mprSelSet[s->num_mpr_sel-1].mainAddr;
     
     for (i = 0; i < s->num_mpr_sel - 1; i++) {
         if (s->mprSelSet[i].mainAddr == last) {
             s->num_mpr_sel--;
-            return;
+            return 0;
         }
     }
     
+    OLSR_SAVE(s, s->ansn);
     s->ansn++;
+    return 1;
 }
 
 /**
- * Direct ripoff of corresponding ns3 function
+ * Direct ripoff of corresponding ns3 function.  The tuples with T_last_addr
+ * last are the row last of the topology set, so this returns that row if
+ * it holds tuples newer than ansn and -1 otherwise.
  */
-top_tuple * FindNewerTopologyTuple(o_addr last, uint16_t ansn, node_state *s)
+int FindNewerTopologyTuple(o_local last, uint16_t ansn, node_state *s)
 {
-    int i;
+    if (s->topSet.destAddr[last] && s->topSet.sequenceNumber[last] > ansn)
+        return last;
     
-    for (i = 0; i < s->num_top_set; i++) {
-        if (s->topSet[i].lastAddr == last && s->topSet[i].sequenceNumber > ansn)
-            return &s->topSet[i];
-    }
-    
-    return NULL;
+    return -1;
 }
 
 /**
- * Direct ripoff of corresponding ns3 function
+ * Remove every topology tuple with T_last_addr last
  */
-void EraseOlderTopologyTuples(o_addr last, uint16_t ansn, node_state *s)
+static void top_remove(node_state *s, o_local last)
 {
-    int i;
-    int index_to_remove;
-    
-    while (1) {
-        index_to_remove = -1;
-        for (i = 0; i < s->num_top_set; i++) {
-            if (s->topSet[i].lastAddr == last && s->topSet[i].sequenceNumber < ansn) {
-                index_to_remove = i;
-                break;
-            }
-        }
-        
-        if (index_to_remove == -1) break;
-        
-        s->topSet[index_to_remove].destAddr = s->topSet[s->num_top_set-1].destAddr;
-        s->topSet[index_to_remove].expirationTime = s->topSet[s->num_top_set-1].expirationTime;
-        s->topSet[index_to_remove].lastAddr = s->topSet[s->num_top_set-1].lastAddr;
-        s->topSet[index_to_remove].sequenceNumber = s->topSet[s->num_top_set-1].sequenceNumber;
-        s->num_top_set--;
-    }
+    OLSR_SAVE(s, s->topSet.destAddr[last]);
+    OLSR_UNDO(s->top_removed[last] = s->topSet.destAddr[last]);
+    routes_changed(s);
+    s->topSet.destAddr[last] = 0;
 }
 
 /**
  * Direct ripoff of corresponding ns3 function
  */
-top_tuple * FindTopologyTuple(o_addr destAddr, o_addr lastAddr, node_state *s)
+void EraseOlderTopologyTuples(o_local last, uint16_t ansn, node_state *s)
 {
-    int i;
-    
-    for (i = 0; i < s->num_top_set; i++) {
-        if (s->topSet[i].destAddr == destAddr && s->topSet[i].lastAddr == lastAddr) {
-            return &s->topSet[i];
-        }
+    if (s->topSet.destAddr[last] && s->topSet.sequenceNumber[last] < ansn) {
+        top_remove(s, last);
     }
+}
+
+/**
+ * Direct ripoff of corresponding ns3 function.  Returns the row holding
+ * the tuple, which is lastAddr, or -1.
+ */
+int FindTopologyTuple(o_local destAddr, o_local lastAddr, node_state *s)
+{
+    if (s->topSet.destAddr[lastAddr] & OLSR_MASK_BIT(destAddr))
+        return lastAddr;
     
-    return NULL;
+    return -1;
 }
 
-neigh_tuple * FindSymNeighborTuple(node_state *s, o_addr mainAddr)
+neigh_tuple * FindSymNeighborTuple(node_state *s, o_local mainAddr)
 {
     int i;
     
@@ -504,210 +630,340 @@ neigh_tuple * FindSymNeighborTuple(node_state *s, o_addr mainAddr)
     return NULL;
 }
 
-RT_entry * Lookup(node_state *s, o_addr dest)
+/**
+ * Record a route to the region-local index v
+ */
+static inline void set_route(node_state *s, int v, o_local next, uint32_t distance)
 {
-    int i;
-    
-    for (i = 0; i < s->num_routes; i++) {
-        if (s->route_table[i].destAddr == dest) {
-            return &s->route_table[i];
-        }
-    }
-    
-    return NULL;
+    s->route_table[v].destAddr = v;
+    s->route_table[v].nextAddr = next;
+    s->route_table[v].distance = distance;
+    s->route_valid |= OLSR_MASK_BIT(v);
 }
 
 /**
  * Trying to ripoff the corresponding ns3 function :)
  * Fortunately we don't need steps 4 or 5 since we don't support
  * multiple interfaces or HNA.
+ *
+ * Every destination is in our region, so the table is indexed by
+ * region-local address and the whole computation is a BFS over per-node
+ * adjacency masks: the 2-hop set (s->two_hop_mask) gives the edges out of
+ * our neighbors, the topology matrix the edges out of everything further
+ * away.  Each level is the OR of the rows of the level before it, and a
+ * node takes the next hop of the first row it appears in, so when it can
+ * be reached through several nodes of the previous level the one with the
+ * lowest region-local address provides the next hop.
  */
 void RoutingTableComputation(node_state *s)
 {
-    int i, h;
-    RT_entry *route;
+    int u, v;
+    uint32_t h;
+    const olsr_mask *adj;
+    olsr_mask visited;
+    olsr_mask frontier;
+    olsr_mask next;
+    olsr_mask reach;
+    olsr_mask m;
     
     // 1. All the entries from the routing table are removed.
-    s->num_routes = 0;
+    s->route_valid = 0;
+    
+    // We never route to ourselves
+    visited = OLSR_MASK_BIT(OLSR_LOCAL(s->local_address));
     
     // 2. The new routing entries are added starting with the
     // symmetric neighbors (h=1) as the destination nodes.
-    for (i = 0; i < s->num_neigh; i++) {
-        s->route_table[s->num_routes].destAddr = s->neighSet[i].neighborMainAddr;
-        s->route_table[s->num_routes].nextAddr = s->neighSet[i].neighborMainAddr;
-        s->route_table[s->num_routes].distance = 1;
-        s->num_routes++;
-        assert(s->num_routes < OLSR_MAX_ROUTES);
+    frontier = s->neigh_mask;
+    for (m = frontier; m; m &= m - 1) {
+        v = olsr_ctz(m);
+        set_route(s, v, v, 1);
     }
+    visited |= frontier;
     
     //  3. for each node in N2, i.e., a 2-hop neighbor which is not a
     //  neighbor node or the node itself, and such that there exist at
     //  least one entry in the 2-hop neighbor set where
     //  N_neighbor_main_addr correspond to a neighbor node with
-    //  willingness different of WILL_NEVER,
-    for (i = 0; i < s->num_two_hop; i++) {
-        
-        if (FindSymNeighborTuple(s, s->twoHopSet[i].twoHopNeighborAddr)) {
-            continue;
-        }
-        
-        if (s->twoHopSet[i].twoHopNeighborAddr == s->local_address) {
-            continue;
-        }
-        
-        // one selects one 2-hop tuple and creates one entry in the routing table with:
-        //                R_dest_addr  =  the main address of the 2-hop neighbor;
-        //                R_next_addr  = the R_next_addr of the entry in the
-        //                               routing table with:
-        //                                   R_dest_addr == N_neighbor_main_addr
-        //                                                  of the 2-hop tuple;
-        //                R_dist       = 2;
-        //                R_iface_addr = the R_iface_addr of the entry in the
-        //                               routing table with:
-        //                                   R_dest_addr == N_neighbor_main_addr
-        //                                                  of the 2-hop tuple;
-        if ((route = Lookup(s, s->twoHopSet[i].neighborMainAddr))) {
-            s->route_table[s->num_routes].destAddr = s->twoHopSet[i].twoHopNeighborAddr;
-            s->route_table[s->num_routes].nextAddr = route->nextAddr;
-            s->route_table[s->num_routes].distance = 2;
-            s->num_routes++;
-            assert(s->num_routes < OLSR_MAX_ROUTES);
-        }
-    }
-    
+    //  willingness different of WILL_NEVER, one selects one 2-hop tuple
+    //  and creates one entry in the routing table with R_dist = 2 and
+    //  the R_next_addr of the entry for N_neighbor_main_addr.
     // 3.1. For each topology entry in the topology table, if its
     // T_dest_addr does not correspond to R_dest_addr of any
     // route entry in the routing table AND its T_last_addr
     // corresponds to R_dest_addr of a route entry whose R_dist
     // is equal to h, then a new route entry MUST be recorded in
-    // the routing table (if it does not already exist)
-    for (h = 2; ; h++) {
-        int added = 0;
-        
-        for (i = 0; i < s->num_top_set; i++) {
-            //printf("Looking at node %lu top_tuple[%d] dest: %lu, last: %lu, seq: %d\n", s->local_address, i, s->topSet[i].destAddr, s->topSet[i].lastAddr, s->topSet[i].sequenceNumber);
-            RT_entry *destAddrEntry = Lookup(s, s->topSet[i].destAddr);
-            RT_entry *lastAddrEntry = Lookup(s, s->topSet[i].lastAddr);
-            if (!destAddrEntry && lastAddrEntry && lastAddrEntry->distance == h) {
-                s->route_table[s->num_routes].destAddr = s->topSet[i].destAddr;
-                s->route_table[s->num_routes].nextAddr = lastAddrEntry->nextAddr;
-                s->route_table[s->num_routes].distance = h + 1;
-                s->num_routes++;
-                assert(s->num_routes < OLSR_MAX_ROUTES);
-                added = 1;
-            }
-            else {
-                if (lastAddrEntry && !destAddrEntry) {
-                    //printf("Not right length!\n");
-                }
+    // the routing table (if it does not already exist).  This starts
+    // at h=2, so neighbors only ever lead on through the 2-hop set.
+    adj = s->two_hop_mask;
+    for (h = 1; frontier; h++) {
+        next = 0;
+        for (m = frontier; m; m &= m - 1) {
+            u = olsr_ctz(m);
+            reach = adj[u] & ~visited & ~next;
+            next |= reach;
+            for (; reach; reach &= reach - 1) {
+                set_route(s, olsr_ctz(reach), s->route_table[u].nextAddr, h + 1);
             }
         }
-        
-        if (!added) {
-            break;
-        }
+        visited |= next;
+        frontier = next;
+        adj = s->topSet.destAddr;
     }
 }
 
-dup_tuple * FindDuplicateTuple(o_addr addr, uint16_t seq_num, node_state *s)
+/**
+ * Route to dest, rebuilding the routing table first if the sets it is
+ * computed from have changed since it was last built.  The entry holds
+ * region-local addresses.
+ */
+RT_entry * Lookup(node_state *s, o_addr dest)
 {
-    int i;
+    if (s->routes_dirty) {
+        // A rollback past the change that dirtied the table needs it back
+        OLSR_SAVE(s, s->routes_dirty);
+        OLSR_SAVE(s, s->route_table);
+        OLSR_SAVE(s, s->route_valid);
+        s->routes_dirty = 0;
+        OLSR_TIME_BEGIN(t);
+        RoutingTableComputation(s);
+        OLSR_TIME_END(t, OLSR_COST_ROUTES);
+    }
+    
+    if (region(dest) != region(s->local_address) ||
+        !(s->route_valid & OLSR_MASK_BIT(OLSR_LOCAL(dest)))) {
+        return NULL;
+    }
+    
+    return &s->route_table[OLSR_LOCAL(dest)];
+}
+
+static inline unsigned dup_bucket(o_local addr, uint16_t seq_num)
+{
+    uint32_t key = (uint32_t)addr * 65599u + seq_num;
+    
+    return (key * 2654435761u) >> (32 - OLSR_DUP_HASH_BITS);
+}
+
+dup_tuple * FindDuplicateTuple(o_local addr, uint16_t seq_num, node_state *s)
+{
+    unsigned h = dup_bucket(addr, seq_num);
+    uint8_t i;
     
-    for (i = 0; i < s->num_dupes; i++) {
+    // The table is never more than half full, so this finds a hole
+    while ((i = s->dup_hash[h]) != OLSR_DUP_NONE) {
         if (s->dupSet[i].address == addr && s->dupSet[i].sequenceNumber == seq_num) {
             return &s->dupSet[i];
         }
+        h = (h + 1) & (OLSR_DUP_HASH_SIZE - 1);
     }
     
     return NULL;
 }
 
 /**
- * Had to add this function to minimize our dupe array
+ * Take tuple i out of the hash.  Later entries of the probe run are
+ * shifted back into the hole so no tombstones are needed.
  */
-void AddDuplicate(o_addr originator,
-                  uint16_t seq_num,
-                  Time ts,
-                  int retransmitted,
-                  node_state *s,
-                  tw_lp *lp)
+static void dup_unhash(node_state *s, uint8_t i)
 {
-    int i;
-    int index_to_remove;
-    Time exp = tw_now(lp);
+    unsigned h = dup_bucket(s->dupSet[i].address, s->dupSet[i].sequenceNumber);
+    unsigned j, k;
+    uint8_t x;
     
-    while (1) {
-        index_to_remove = -1;
-        for (i = 0; i < s->num_dupes; i++) {
-            if (s->dupSet[i].expirationTime < exp) {
-                index_to_remove = i;
-                break;
-            }
-        }
-        
-        if (index_to_remove == -1) break;
-        
-        //printf("Expiring Dupe\n");
-        
-        s->dupSet[index_to_remove].address        = s->dupSet[s->num_dupes-1].address;
-        s->dupSet[index_to_remove].expirationTime = s->dupSet[s->num_dupes-1].expirationTime;
-        s->dupSet[index_to_remove].retransmitted  = s->dupSet[s->num_dupes-1].retransmitted;
-        s->dupSet[index_to_remove].sequenceNumber = s->dupSet[s->num_dupes-1].sequenceNumber;
-        s->num_dupes--;
+    while (s->dup_hash[h] != i) {
+        h = (h + 1) & (OLSR_DUP_HASH_SIZE - 1);
     }
     
-    if (s->num_dupes == OLSR_MAX_DUPES - 1) {
-        // Find the oldest and replace it
-        int oldest = 0;
+    for (j = h; ; ) {
+        j = (j + 1) & (OLSR_DUP_HASH_SIZE - 1);
+        x = s->dup_hash[j];
+        if (x == OLSR_DUP_NONE) break;
         
-        for (i = 0; i < s->num_dupes; i++) {
-            if (s->dupSet[i].expirationTime < s->dupSet[oldest].expirationTime) {
-                oldest = i;
-            }
+        // x may fill the hole unless its home bucket lies in (h, j]
+        k = dup_bucket(s->dupSet[x].address, s->dupSet[x].sequenceNumber);
+        if (((j - k) & (OLSR_DUP_HASH_SIZE - 1)) >= ((j - h) & (OLSR_DUP_HASH_SIZE - 1))) {
+            OLSR_SAVE(s, s->dup_hash[h]);
+            s->dup_hash[h] = x;
+            h = j;
         }
-        
-        //printf("node %lu (lpid = %llu) evicting dup %d (%lu) at time %f\n", s->local_address, lp->gid,
-         //      oldest, s->dupSet[oldest].address, tw_now(lp));
-        
-        s->dupSet[oldest].address = originator;
-        s->dupSet[oldest].sequenceNumber = seq_num;
-        s->dupSet[oldest].expirationTime = ts;
-        s->dupSet[oldest].retransmitted = retransmitted;
     }
-    else {
-        s->dupSet[s->num_dupes].address = originator;
-        s->dupSet[s->num_dupes].sequenceNumber = seq_num;
-        s->dupSet[s->num_dupes].expirationTime = ts;
-        s->dupSet[s->num_dupes].retransmitted = retransmitted;
-        s->num_dupes++;
-        assert(s->num_dupes < OLSR_MAX_DUPES);
+    
+    OLSR_SAVE(s, s->dup_hash[h]);
+    s->dup_hash[h] = OLSR_DUP_NONE;
+}
+
+/**
+ * Put tuple i at the young end of the expiry ring.  Every tuple expires
+ * OLSR_DUP_HOLD_TIME after it was last added or refreshed, so appending
+ * keeps the ring in expiry order.
+ */
+static void dup_link(node_state *s, uint8_t i)
+{
+    uint8_t oldest = s->dup_oldest;
+    uint8_t newest;
+    
+    if (oldest == OLSR_DUP_NONE) {
+        OLSR_SAVE(s, s->dup_oldest);
+        s->dup_oldest = i;
+        s->dupSet[i].prev = i;
+        s->dupSet[i].next = i;
+        return;
     }
+    
+    newest = s->dupSet[oldest].prev;
+    assert(s->dupSet[newest].expirationTime <= s->dupSet[i].expirationTime);
+    
+    OLSR_SAVE(s, s->dupSet[newest].next);
+    OLSR_SAVE(s, s->dupSet[oldest].prev);
+    s->dupSet[i].prev = newest;
+    s->dupSet[i].next = oldest;
+    s->dupSet[newest].next = i;
+    s->dupSet[oldest].prev = i;
 }
 
-void printTC(olsr_msg_data *m, node_state *s)
+static void dup_unlink(node_state *s, uint8_t i)
 {
-#ifdef JML_DEBUG
-    int i;
+    uint8_t prev = s->dupSet[i].prev;
+    uint8_t next = s->dupSet[i].next;
     
-    printf("Node %lu has %d neighbors:\n", s->local_address, s->num_neigh);
-    for (i = 0; i < s->num_neigh; i++) {
-        printf("   neighbor %lu\n", s->neighSet[i].neighborMainAddr);
-    }
-    printf("Received TC message with %d neighbors of node %lu\n",
-           m->mt.t.num_neighbors, m->originator);
-    for (i = 0; i < m->mt.t.num_neighbors; i++) {
-        printf("   TC-NEIGH %lu\n", m->mt.t.neighborAddresses[i]);
+    if (s->dup_oldest == i) {
+        OLSR_SAVE(s, s->dup_oldest);
+        s->dup_oldest = (next == i) ? OLSR_DUP_NONE : next;
     }
-    printf("\n");
-    
-#endif /* JML_DEBUG */
     
-    //printf("Node %lu just heard a TC from %lu\n", s->local_address, m->originator);
+    OLSR_SAVE(s, s->dupSet[prev].next);
+    OLSR_SAVE(s, s->dupSet[next].prev);
+    s->dupSet[prev].next = next;
+    s->dupSet[next].prev = prev;
+}
+
+static void dup_remove(node_state *s, uint8_t i)
+{
+    dup_unhash(s, i);
+    dup_unlink(s, i);
+    
+    OLSR_SAVE(s, s->dupSet[i].next);
+    OLSR_SAVE(s, s->dup_free);
+    OLSR_SAVE(s, s->num_dupes);
+    s->dupSet[i].next = s->dup_free;
+    s->dup_free = i;
+    s->num_dupes--;
+}
+
+/**
+ * Drop the tuples that expired before now and, if the set is still full,
+ * the one closest to expiring.  Both come off the old end of the expiry
+ * ring.  Returns how many went.
+ */
+static unsigned dup_make_room(node_state *s, Time now)
+{
+    unsigned removed = 0;
+    Time exp = now;
+    
+    while (s->dup_oldest != OLSR_DUP_NONE &&
+           s->dupSet[s->dup_oldest].expirationTime < exp) {
+        //printf("Expiring Dupe\n");
+        dup_remove(s, s->dup_oldest);
+        removed++;
+    }
+    
+    if (s->num_dupes == OLSR_MAX_DUPES - 1) {
+        //printf("node %lu (lpid = %llu) evicting dup %d (%lu) at time %f\n", s->local_address, lp->gid,
+         //      s->dup_oldest, s->dupSet[s->dup_oldest].address, now);
+        dup_remove(s, s->dup_oldest);
+        removed++;
+    }
+    
+    return removed;
+}
+
+static void dup_hash_insert(node_state *s, uint8_t i)
+{
+    unsigned h = dup_bucket(s->dupSet[i].address, s->dupSet[i].sequenceNumber);
+    
+    while (s->dup_hash[h] != OLSR_DUP_NONE) {
+        h = (h + 1) & (OLSR_DUP_HASH_SIZE - 1);
+    }
+    OLSR_SAVE(s, s->dup_hash[h]);
+    s->dup_hash[h] = i;
+}
+
+/**
+ * Had to add this function to minimize our dupe array.  Expired tuples
+ * (those that expired before now) are dropped first and, if the set is
+ * still full, the one closest to expiring makes room.
+ */
+void AddDuplicate(o_local originator,
+                  uint16_t seq_num,
+                  Time ts,
+                  int retransmitted,
+                  node_state *s,
+                  Time now)
+{
+    uint8_t i;
+    
+    dup_make_room(s, now);
+    
+    i = s->dup_free;
+    assert(i != OLSR_DUP_NONE);
+    OLSR_SAVE(s, s->dup_free);
+    OLSR_SAVE(s, s->dupSet[i]);
+    OLSR_SAVE(s, s->num_dupes);
+    s->dup_free = s->dupSet[i].next;
+    s->dupSet[i].address = originator;
+    s->dupSet[i].sequenceNumber = seq_num;
+    s->dupSet[i].expirationTime = ts;
+    s->dupSet[i].retransmitted = retransmitted;
+    s->num_dupes++;
+    assert(s->num_dupes < OLSR_MAX_DUPES);
+    
+    dup_hash_insert(s, i);
+    dup_link(s, i);
+}
+
+/**
+ * Push back the expiry of a tuple we have seen again, moving it to the
+ * young end of the ring.
+ */
+static void RefreshDuplicate(dup_tuple *duplicated,
+                             Time ts,
+                             int retransmitted,
+                             node_state *s)
+{
+    uint8_t i = duplicated - s->dupSet;
+    
+    dup_unlink(s, i);
+    OLSR_SAVE(s, *duplicated);
+    duplicated->expirationTime = ts;
+    duplicated->retransmitted = retransmitted;
+    dup_link(s, i);
+}
+
+void printTC(olsr_msg_data *m, node_state *s)
+{
+#ifdef JML_DEBUG
+    int i;
+    
+    printf("Node %lu has %d neighbors:\n", s->local_address, s->num_neigh);
+    for (i = 0; i < s->num_neigh; i++) {
+        printf("   neighbor %u\n", s->neighSet[i].neighborMainAddr);
+    }
+    printf("Received TC message with %d neighbors of node %lu\n",
+           m->mt.t.num_neighbors, m->originator);
+    for (i = 0; i < m->mt.t.num_neighbors; i++) {
+        printf("   TC-NEIGH %u\n", m->mt.t.neighborAddresses[i]);
+    }
+    printf("\n");
+    
+#endif /* JML_DEBUG */
+    
+    //printf("Node %lu just heard a TC from %lu\n", s->local_address, m->originator);
 }
 
 ///
-/// \brief OLSR's default forwarding algorithm.
-///
+/// \brief OLSR's default forwarding algorithm.
+///
 /// See RFC 3626 for details.
 ///
 /// \param p the %OLSR packet which has been received.
@@ -719,17 +975,13 @@ void printTC(olsr_msg_data *m, node_state *s)
 void ForwardDefault(olsr_msg_data *olsrMessage,
                     dup_tuple *duplicated,
                     o_addr localIface,
-                    o_addr senderAddress,
+                    o_local senderAddress,
                     node_state *s,
+                    tw_bf *bf,
                     tw_lp *lp)
 {
     int i;
-    int j;
-    TC *t;
-    tw_event *e;
-    tw_stime ts;
-    tw_lp *cur_lp;
-    olsr_msg_data *msg;
+    olsr_msg_data msg;
     
     // If the sender interface address is not in the symmetric
     // 1-hop neighborhood the message must not be forwarded
@@ -751,33 +1003,20 @@ void ForwardDefault(olsr_msg_data *olsrMessage,
     for (i = 0; i < s->num_mpr_sel; i++) {
         if (s->mprSelSet[i].mainAddr == senderAddress) {
             // Round-robin-RX
-            // Might want to rename HELLO_DELTA...
-            ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
-            // ts += 1;
-            
-            cur_lp = tw_getlocal_lp(region(s->local_address)*OLSR_MAX_NEIGHBORS);
-            
-            e = tw_event_new(cur_lp->gid, ts, lp);
-            msg = tw_event_data(e);
-            msg->type = TC_RX;
-            msg->ttl = olsrMessage->ttl - 1;
-            msg->originator = olsrMessage->originator;
-            msg->sender = s->local_address;
-            msg->lng = s->lng;
-            msg->lat = s->lat;
-            msg->target = region(s->local_address) * OLSR_MAX_NEIGHBORS;
-            t = &msg->mt.t;
-            t->ansn = olsrMessage->mt.t.ansn;
-            //t->num_mpr_sel = olsrMessage->mt.t.num_mpr_sel;
-            t->num_neighbors = olsrMessage->mt.t.num_neighbors;
-            for (j = 0; j < t->num_neighbors; j++) {
-                t->neighborAddresses[j] = olsrMessage->mt.t.neighborAddresses[j];
-            }
+            memset(&msg, 0, sizeof(msg));
+            msg.type = TC_RX;
+            msg.ttl = olsrMessage->ttl - 1;
+            msg.originator = olsrMessage->originator;
+            msg.seq_num = olsrMessage->seq_num;
+            msg.sender = s->local_address;
+            msg.lng = s->lng;
+            msg.lat = s->lat;
+            msg.mt.t = olsrMessage->mt.t;
             //if (t->num_mpr_sel > 0) {
             //printTC(t);
-            tw_event_send(e);
+            olsr_broadcast(s, &msg, lp);
+            bf->c4 = 1;
             //}
-            //tw_event_send(e);
             
             
             retransmitted = 1;
@@ -786,16 +1025,26 @@ void ForwardDefault(olsr_msg_data *olsrMessage,
         }
     }
     
+    OLSR_TIME_BEGIN(t);
     if (duplicated != NULL) {
-        duplicated->expirationTime = tw_now(lp) + OLSR_DUP_HOLD_TIME;
-        duplicated->retransmitted = retransmitted;
+        bf->c11 = 1;
+        OLSR_UNDO(olsrMessage->undo.rx.tc.dup = *duplicated;
+                  olsrMessage->undo.rx.tc.dup_oldest = s->dup_oldest);
+        RefreshDuplicate(duplicated,
+                         tw_now(lp) + OLSR_DUP_HOLD_TIME,
+                         retransmitted,
+                         s);
     }
     else {
-      AddDuplicate(olsrMessage->originator,
+      bf->c12 = 1;
+      // Make room first so the undo record gets the slot actually used
+      OLSR_UNDO(olsrMessage->undo.rx.tc.dup_removed = dup_make_room(s, tw_now(lp));
+                olsrMessage->undo.rx.tc.dup = s->dupSet[s->dup_free]);
+      AddDuplicate(OLSR_LOCAL(olsrMessage->originator),
 		   olsrMessage->seq_num,
 		   tw_now(lp) + OLSR_DUP_HOLD_TIME,
 		   retransmitted,
-		   s, lp);
+		   s, tw_now(lp));
 
       //        s->dupSet[s->num_dupes].address = olsrMessage->originator;
       //        s->dupSet[s->num_dupes].sequenceNumber = olsrMessage->seq_num;
@@ -804,6 +1053,7 @@ void ForwardDefault(olsr_msg_data *olsrMessage,
       //        s->num_dupes++;
       //        assert(s->num_dupes < OLSR_MAX_DUPES);
     }
+    OLSR_TIME_END(t, OLSR_COST_DUPS);
 }
 
 void route_packet(node_state *s, tw_event *e)
@@ -820,15 +1070,665 @@ void route_packet(node_state *s, tw_event *e)
     //printf("routing from %lu to %lu, next hop %lu\n", m->originator,
     //       m->destination, route->nextAddr);
     
-    m->sender = route->nextAddr;
-    tw_event_send(e);
+    m->sender = OLSR_GLOBAL(s->local_address, route->nextAddr);
+    olsr_event_send(e);
+}
+
+/**
+ * Compute D(y) as described in the "MPR Computation" section: the number of
+ * symmetric neighbors of y, EXCLUDING all the members of N and EXCLUDING
+ * the node performing the computation.  MprComputation() works this out
+ * for all of N at once; this is for reporting a single neighbor.
+ */
+unsigned Dy(node_state *s, o_local target)
+{
+    return olsr_popcount(s->two_hop_mask[target] & ~s->neigh_mask);
+}
+
+/**
+ * MPR computation as described in RFC 3626 section 8.3.1, following the
+ * greedy heuristic in ns3.  Rebuilds s->mprSet from the current 1-hop and
+ * 2-hop neighbor sets.
+ *
+ * Every 2-hop neighbor is in our region, so the members of N2 reachable
+ * through a 1-hop neighbor fit in one olsr_mask (s->two_hop_mask, copied
+ * into w->coverage in neighSet order) and its reachability is just
+ * popcount(coverage & ~covered).  Also rebuilds s->mpr_mask.
+ *
+ * Only s and w are written, so calls with different scratch contexts can
+ * run side by side.
+ */
+void MprComputation(node_state *s, olsr_mpr_scratch *w)
+{
+    int i, j;
+    // neighSet index of each region-local address in N
+    int index_of[OLSR_MAX_NEIGHBORS];
+    olsr_mask n1 = s->neigh_mask;
+    olsr_mask once = 0;
+    olsr_mask twice = 0;
+    olsr_mask only;
+    olsr_mask covered = 0;
+    olsr_mask chosen = 0;
+    
+    s->num_mpr = 0;
+    s->mpr_mask = 0;
+    
+    for (i = 0; i < s->num_neigh; i++) {
+        index_of[s->neighSet[i].neighborMainAddr] = i;
+        w->coverage[i] = s->two_hop_mask[s->neighSet[i].neighborMainAddr];
+    }
+    
+    // 2. Calculate D(y), where y is a member of N, for all nodes in N:
+    // its symmetric neighbors, EXCLUDING all the members of N.
+    for (i = 0; i < s->num_neigh; i++) {
+        w->Dy[i] = olsr_popcount(w->coverage[i] & ~n1);
+        twice |= once & w->coverage[i];
+        once |= w->coverage[i];
+    }
+    
+    // 3. Add to the MPR set those nodes in N, which are the *only*
+    // nodes to provide reachability to a node in N2.  They go in in the
+    // order of their 2-hop tuples, as in ns3.
+    only = once & ~twice;
+    
+    for (i = 0; i < s->num_two_hop; i++) {
+        if (!(only & OLSR_MASK_BIT(s->twoHopSet.twoHopNeighborAddr[i])))
+            continue;
+        
+        assert(n1 & OLSR_MASK_BIT(s->twoHopSet.neighborMainAddr[i]));
+        j = index_of[s->twoHopSet.neighborMainAddr[i]];
+        if (chosen & OLSR_MASK_BIT(j))
+            continue;
+        
+        chosen |= OLSR_MASK_BIT(j);
+        covered |= w->coverage[j];
+        s->mprSet[s->num_mpr] = s->neighSet[j].neighborMainAddr;
+        s->mpr_mask |= OLSR_MASK_BIT(s->mprSet[s->num_mpr]);
+        s->num_mpr++;
+        assert(s->num_mpr < OLSR_MAX_NEIGHBORS);
+    }
+    
+    // 4. While there exist nodes in N2 which are not covered by at
+    // least one node in the MPR set:
+    while (once & ~covered) {
+        unsigned max = 0;
+        unsigned max_Dy = 0;
+        int best = -1;
+        
+        // 4.1. For each node in N, calculate the reachability, i.e., the
+        // number of nodes in N2 which are not yet covered by at
+        // least one node in the MPR set, and which are reachable
+        // through this 1-hop neighbor
+        // 4.2. Select as a MPR the node which provides reachability to
+        // the maximum number of nodes in N2.  In case of multiple nodes
+        // providing the same amount of reachability, select the node as
+        // MPR whose D(y) is greater.
+        for (i = 0; i < s->num_neigh; i++) {
+            unsigned r = olsr_popcount(w->coverage[i] & ~covered);
+            
+            if (r == 0) continue;
+            
+            if (r > max || (r == max && w->Dy[i] > max_Dy)) {
+                max = r;
+                max_Dy = w->Dy[i];
+                best = i;
+            }
+        }
+        
+        assert(best >= 0);
+        covered |= w->coverage[best];
+        s->mprSet[s->num_mpr] = s->neighSet[best].neighborMainAddr;
+        s->mpr_mask |= OLSR_MASK_BIT(s->mprSet[s->num_mpr]);
+        s->num_mpr++;
+        assert(s->num_mpr < OLSR_MAX_NEIGHBORS);
+    }
+}
+
+/**
+ * Remove "n" from N2 (stored in w)
+ */
+static inline void remove_node_from_n2(olsr_mpr_greedy_scratch *w, o_local n)
+{
+    int i;
+    int index_to_remove;
+    
+    while (1) {
+        index_to_remove = -1;
+        for (i = 0; i < w->num_two_hop; i++) {
+            if (w->twoHopNeighborAddr[i] == n) {
+                index_to_remove = i;
+                break;
+            }
+        }
+        
+        if (index_to_remove == -1) break;
+        
+        w->neighborMainAddr[index_to_remove] = w->neighborMainAddr[w->num_two_hop-1];
+        w->twoHopNeighborAddr[index_to_remove] = w->twoHopNeighborAddr[w->num_two_hop-1];
+        w->num_two_hop--;
+    }
+}
+
+/**
+ * Remove the nodes from N2 which are now covered by a node in the MPR set.
+ * remove_node_from_n2() moves the last tuple into each slot it frees, and
+ * that tuple may be covered as well, so slot i is looked at again rather
+ * than skipped.
+ */
+static void remove_covered_from_n2(olsr_mpr_greedy_scratch *w, olsr_mask covered)
+{
+    int i;
+    
+    for (i = 0; i < w->num_two_hop; ) {
+        if (covered & OLSR_MASK_BIT(w->twoHopNeighborAddr[i])) {
+            remove_node_from_n2(w, w->twoHopNeighborAddr[i]);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+/**
+ * Add n to the MPR set unless it is already in it, and note the 2-hop
+ * neighbors it covers
+ */
+static olsr_mask mpr_greedy_add(node_state *s, olsr_mpr_greedy_scratch *w, o_local n)
+{
+    int j;
+    olsr_mask covered = 0;
+    
+    if (!(s->mpr_mask & OLSR_MASK_BIT(n))) {
+        s->mprSet[s->num_mpr] = n;
+        s->mpr_mask |= OLSR_MASK_BIT(n);
+        s->num_mpr++;
+        assert(s->num_mpr < OLSR_MAX_NEIGHBORS);
+    }
+    
+    for (j = 0; j < w->num_two_hop; j++) {
+        if (w->neighborMainAddr[j] == n) {
+            covered |= OLSR_MASK_BIT(w->twoHopNeighborAddr[j]);
+        }
+    }
+    
+    return covered;
+}
+
+/**
+ * The greedy heuristic of RFC 3626 section 8.3.1 tuple by tuple, as ns3
+ * runs it, on a copy of N2.  MprComputation() must build the same mprSet,
+ * in the same order; this is what olsr-test.cpp checks it against.
+ */
+void MprComputationGreedy(node_state *s, olsr_mpr_greedy_scratch *w)
+{
+    int i, j;
+    olsr_mask covered = 0;
+    
+    s->num_mpr = 0;
+    s->mpr_mask = 0;
+    
+    w->num_two_hop = s->num_two_hop;
+    for (i = 0; i < s->num_two_hop; i++) {
+        w->neighborMainAddr[i] = s->twoHopSet.neighborMainAddr[i];
+        w->twoHopNeighborAddr[i] = s->twoHopSet.twoHopNeighborAddr[i];
+    }
+    
+    // 2. Calculate D(y), where y is a member of N, for all nodes in N.
+    for (i = 0; i < s->num_neigh; i++) {
+        w->Dy[i] = Dy(s, s->neighSet[i].neighborMainAddr);
+    }
+    
+    // 3. Add to the MPR set those nodes in N, which are the *only*
+    // nodes to provide reachability to a node in N2.
+    for (i = 0; i < w->num_two_hop; i++) {
+        int onlyOne = 1;
+        // try to find another neighbor that can reach twoHopNeigh->twoHopNeighborAddr
+        for (j = 0; j < w->num_two_hop; j++) {
+            if (w->twoHopNeighborAddr[j] == w->twoHopNeighborAddr[i]
+                && w->neighborMainAddr[j] != w->neighborMainAddr[i]) {
+                onlyOne = 0;
+                break;
+            }
+        }
+        
+        if (onlyOne) {
+            covered |= mpr_greedy_add(s, w, w->neighborMainAddr[i]);
+        }
+    }
+    
+    remove_covered_from_n2(w, covered);
+    
+    // 4. While there exist nodes in N2 which are not covered by at
+    // least one node in the MPR set:
+    while (w->num_two_hop) {
+        unsigned max = 0;
+        unsigned max_Dy = 0;
+        o_local to_add = 0;
+        
+        // 4.1. For each node in N, calculate the reachability, i.e., the
+        // number of nodes in N2 which are not yet covered by at
+        // least one node in the MPR set, and which are reachable
+        // through this 1-hop neighbor
+        // 4.2. Select as a MPR the node which provides reachability to
+        // the maximum number of nodes in N2, the one whose D(y) is
+        // greater if several do.
+        for (i = 0; i < s->num_neigh; i++) {
+            unsigned r = 0;
+            
+            for (j = 0; j < w->num_two_hop; j++) {
+                if (w->neighborMainAddr[j] == s->neighSet[i].neighborMainAddr)
+                    r++;
+            }
+            
+            if (r == 0) continue;
+            
+            if (r > max || (r == max && w->Dy[i] > max_Dy)) {
+                max = r;
+                max_Dy = w->Dy[i];
+                to_add = s->neighSet[i].neighborMainAddr;
+            }
+        }
+        
+        assert(max > 0);
+        covered |= mpr_greedy_add(s, w, to_add);
+        remove_covered_from_n2(w, covered);
+    }
+}
+
+/**
+ * Rebuild the MPR set if the 1-hop or 2-hop set changed since it was last
+ * built.  It is a function of those sets alone, so this gives the same set
+ * recomputing after every change would have.  Returns 1 if it rebuilt it.
+ */
+static int mpr_current(node_state *s)
+{
+    if (!s->mpr_dirty) return 0;
+    
+    // A rollback past the change that dirtied the set needs it back
+    OLSR_SAVE(s, s->mpr_dirty);
+    OLSR_SAVE(s, s->mprSet);
+    OLSR_SAVE(s, s->num_mpr);
+    OLSR_SAVE(s, s->mpr_mask);
+    s->mpr_dirty = 0;
+    OLSR_TIME_BEGIN(t);
+    MprComputation(s, &g_mpr_scratch);
+    OLSR_TIME_END(t, OLSR_COST_MPR);
+    g_olsr_stats.mpr_computed++;
+    
+    return 1;
+}
+
+/// The expiry wheel slot for the second holding time t
+static inline wheel_slot * wheel_slot_at(wheel_slot *wheel, Time t)
+{
+    return &wheel[(unsigned long)t % OLSR_WHEEL_SLOTS];
+}
+
+/**
+ * Note in the expiry wheel that something in group a expires at time t.
+ */
+static inline void wheel_add(node_state *s, wheel_slot *wheel, o_local a, Time t)
+{
+    wheel_slot *slot = wheel_slot_at(wheel, t);
+    unsigned long second = (unsigned long)t;
+    olsr_mask bit = OLSR_MASK_BIT(a);
+    
+    if (slot->second != second) {
+        // What it held was for a second the wheel has already swept
+        OLSR_SAVE(s, *slot);
+        slot->second = second;
+        slot->due = bit;
+    }
+    else if (!(slot->due & bit)) {
+        OLSR_SAVE(s, slot->due);
+        slot->due |= bit;
+    }
+}
+
+#if OLSR_REVERSE
+static inline void two_hop_swap(node_state *s, int i, int j)
+{
+    o_local n = s->twoHopSet.neighborMainAddr[i];
+    o_local x = s->twoHopSet.twoHopNeighborAddr[i];
+    Time exp = s->twoHopSet.expirationTime[i];
+    
+    s->twoHopSet.neighborMainAddr[i] = s->twoHopSet.neighborMainAddr[j];
+    s->twoHopSet.twoHopNeighborAddr[i] = s->twoHopSet.twoHopNeighborAddr[j];
+    s->twoHopSet.expirationTime[i] = s->twoHopSet.expirationTime[j];
+    s->twoHopSet.neighborMainAddr[j] = n;
+    s->twoHopSet.twoHopNeighborAddr[j] = x;
+    s->twoHopSet.expirationTime[j] = exp;
+}
+
+/// Copy 2-hop tuple j into u before HELLO_RX overwrites it
+static inline void two_hop_save(node_state *s, int j, two_hop_undo *u)
+{
+    u->neighborMainAddr = s->twoHopSet.neighborMainAddr[j];
+    u->twoHopNeighborAddr = s->twoHopSet.twoHopNeighborAddr[j];
+    u->from = s->two_hop_from[j];
+    u->expirationTime = s->twoHopSet.expirationTime[j];
+}
+#endif
+
+static void remove_two_hop(node_state *s, int i)
+{
+    int last = s->num_two_hop - 1;
+    o_local n = s->twoHopSet.neighborMainAddr[i];
+    
+    OLSR_SAVE(s, s->two_hop_mask[n]);
+    s->two_hop_mask[n] &= ~OLSR_MASK_BIT(s->twoHopSet.twoHopNeighborAddr[i]);
+#if OLSR_REVERSE
+    // Swapped past the end rather than overwritten, see unremove_two_hop()
+    two_hop_swap(s, i, last);
+    s->two_hop_from[last] = i;
+#else
+    OLSR_SAVE(s, s->twoHopSet.neighborMainAddr[i]);
+    OLSR_SAVE(s, s->twoHopSet.twoHopNeighborAddr[i]);
+    OLSR_SAVE(s, s->twoHopSet.expirationTime[i]);
+    OLSR_SAVE(s, s->num_two_hop);
+    s->twoHopSet.neighborMainAddr[i] = s->twoHopSet.neighborMainAddr[last];
+    s->twoHopSet.twoHopNeighborAddr[i] = s->twoHopSet.twoHopNeighborAddr[last];
+    s->twoHopSet.expirationTime[i] = s->twoHopSet.expirationTime[last];
+#endif
+    s->num_two_hop--;
+}
+
+/**
+ * Drop neighbor i along with the 2-hop tuples and the MPR selector entry
+ * we got from it.  Our advertised neighbor set changes, so bump the ANSN.
+ */
+static void remove_neighbor(node_state *s, int i)
+{
+    int j;
+    neigh_tuple removed = s->neighSet[i];
+    o_local addr = removed.neighborMainAddr;
+    
+    OLSR_SAVE(s, s->neighSet[i]);
+    OLSR_SAVE(s, s->num_neigh);
+    OLSR_SAVE(s, s->neigh_mask);
+    s->neighSet[i] = s->neighSet[s->num_neigh-1];
+    OLSR_UNDO(s->neighSet[s->num_neigh-1] = removed;
+              s->neigh_from[s->num_neigh-1] = i);
+    s->num_neigh--;
+    s->neigh_mask &= ~OLSR_MASK_BIT(addr);
+    
+    for (j = 0; j < s->num_two_hop; ) {
+        if (s->twoHopSet.neighborMainAddr[j] == addr) {
+            remove_two_hop(s, j);
+        }
+        else {
+            j++;
+        }
+    }
+    
+    for (j = 0; j < s->num_mpr_sel; j++) {
+        if (s->mprSelSet[j].mainAddr == addr) {
+            OLSR_SAVE(s, s->mprSelSet[j]);
+            OLSR_SAVE(s, s->num_mpr_sel);
+            s->mprSelSet[j] = s->mprSelSet[s->num_mpr_sel-1];
+            OLSR_UNDO(s->mprSelSet[s->num_mpr_sel-1].mainAddr = addr;
+                      s->mpr_sel_from[s->num_mpr_sel-1] = j);
+            s->num_mpr_sel--;
+            break;
+        }
+    }
+    
+    OLSR_SAVE(s, s->ansn);
+    s->ansn++;
+}
+
+#if OLSR_REVERSE
+/**
+ * Take back the newest remove_two_hop() still in effect: the tuple just
+ * past the end goes back where it came from, and the one moved into its
+ * place goes back to the end.
+ */
+static void unremove_two_hop(node_state *s)
+{
+    int p = s->num_two_hop++;
+    int i = s->two_hop_from[p];
+    
+    two_hop_swap(s, i, p);
+    s->two_hop_mask[s->twoHopSet.neighborMainAddr[i]] |=
+        OLSR_MASK_BIT(s->twoHopSet.twoHopNeighborAddr[i]);
+}
+
+/// Like unremove_two_hop(), for the neighbor set
+static void unremove_neighbor(node_state *s)
+{
+    int p = s->num_neigh++;
+    int i = s->neigh_from[p];
+    neigh_tuple removed = s->neighSet[p];
+    
+    s->neighSet[p] = s->neighSet[i];
+    s->neighSet[i] = removed;
+    s->neigh_mask |= OLSR_MASK_BIT(removed.neighborMainAddr);
+}
+
+/// Like unremove_two_hop(), for the MPR selector set
+static void unremove_mpr_sel(node_state *s)
+{
+    int p = s->num_mpr_sel++;
+    int i = s->mpr_sel_from[p];
+    mpr_sel_tuple removed = s->mprSelSet[p];
+    
+    s->mprSelSet[p] = s->mprSelSet[i];
+    s->mprSelSet[i] = removed;
+}
+#endif
+
+/**
+ * What wheel slot k % OLSR_WHEEL_SLOTS holds for a second the sweep up to
+ * limit has not covered yet
+ */
+static inline olsr_mask wheel_due(node_state *s, wheel_slot *wheel,
+                                  unsigned long k, unsigned long limit)
+{
+    wheel_slot *slot = &wheel[k % OLSR_WHEEL_SLOTS];
+    
+    if (slot->second >= s->wheel_next && slot->second < limit) {
+        return slot->due;
+    }
+    
+    return 0;
+}
+
+/**
+ * Drop expired neighbor, 2-hop and topology tuples.  The expiry wheel has
+ * one slot per second saying which neighbors, and whose 2-hop and
+ * topology tuples, may expire during it.  Whenever a second has passed we
+ * check just those groups, so the sets are scanned at most once a second
+ * rather than on every event, and nothing needs an event of its own.
+ * Tuples go within a second of expiring.  Sets bf->c8 if the 1-hop or
+ * 2-hop set changed.
+ */
+static void expire_tuples(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    int i;
+    unsigned long k;
+    unsigned long limit = (unsigned long)tw_now(lp);
+    olsr_mask neigh = 0;
+    olsr_mask two_hop = 0;
+    olsr_mask top = 0;
+    Time now = tw_now(lp);
+    
+    OLSR_UNDO(memset(&m->undo.expire, 0, sizeof(m->undo.expire));
+              m->undo.expire.wheel_next = s->wheel_next);
+    
+    if (s->wheel_next >= limit) return;
+    
+    // After a whole turn of the wheel every slot is due
+    k = s->wheel_next;
+    if (limit - k > OLSR_WHEEL_SLOTS) {
+        k = limit - OLSR_WHEEL_SLOTS;
+    }
+    
+    // Slots are left as they are; wheel_add() reuses them once their
+    // second has been swept
+    for (; k < limit; k++) {
+        neigh |= wheel_due(s, s->wheel_neigh, k, limit);
+        two_hop |= wheel_due(s, s->wheel_two_hop, k, limit);
+        top |= wheel_due(s, s->wheel_top, k, limit);
+    }
+    
+    OLSR_SAVE(s, s->wheel_next);
+    s->wheel_next = limit;
+    
+    OLSR_UNDO(m->undo.expire.num_neigh = s->num_neigh;
+              m->undo.expire.num_two_hop = s->num_two_hop;
+              m->undo.expire.num_mpr_sel = s->num_mpr_sel);
+    
+    // Tuples in a due group that were refreshed are in a later slot too
+    for (i = 0; neigh && i < s->num_neigh; ) {
+        if ((neigh & OLSR_MASK_BIT(s->neighSet[i].neighborMainAddr)) &&
+            s->neighSet[i].expirationTime < now) {
+            remove_neighbor(s, i);
+            bf->c8 = 1;
+        }
+        else {
+            i++;
+        }
+    }
+    
+    for (i = 0; two_hop && i < s->num_two_hop; ) {
+        if ((two_hop & OLSR_MASK_BIT(s->twoHopSet.neighborMainAddr[i])) &&
+            s->twoHopSet.expirationTime[i] < now) {
+            remove_two_hop(s, i);
+            bf->c8 = 1;
+        }
+        else {
+            i++;
+        }
+    }
+    
+    for (; top; top &= top - 1) {
+        i = olsr_ctz(top);
+        if (s->topSet.destAddr[i] && s->topSet.expirationTime[i] < now) {
+            top_remove(s, i);
+            OLSR_UNDO(m->undo.expire.top |= OLSR_MASK_BIT(i));
+        }
+    }
+    
+    OLSR_UNDO(m->undo.expire.num_neigh -= s->num_neigh;
+              m->undo.expire.num_two_hop -= s->num_two_hop;
+              m->undo.expire.num_mpr_sel -= s->num_mpr_sel);
+    
+    if (bf->c8) {
+        mpr_changed(s);
+        routes_changed(s);
+    }
+}
+
+/**
+ * RWALK_CHANGE moves the node to the position in m and leaves the old one
+ * there in its place, so doing it again moves the node back
+ */
+static inline void swap_position(node_state *s, olsr_msg_data *m)
+{
+    double lng = s->lng;
+    double lat = s->lat;
+    
+    s->lng = m->lng;
+    s->lat = m->lat;
+    m->lng = lng;
+    m->lat = lat;
 }
 
 void process_sa(node_state *s, olsr_msg_data *m)
 {
+    OLSR_SAVE(s, s->SA_per_node[m->originator % OLSR_MAX_NEIGHBORS]);
     s->SA_per_node[m->originator % OLSR_MAX_NEIGHBORS]++;
 }
 
+/**
+ * Count the delivery of m between an LP pair of kind pair (dir 1), or take
+ * it back when the event is rolled back (dir -1).  Deliveries from
+ * another rank also count as remote, per event type, per pair and, for
+ * the SA master hierarchy, per level.
+ */
+static inline void count_delivery(olsr_msg_data *m, olsr_pair pair, int dir)
+{
+    olsr_stats *st = &g_olsr_stats;
+    int remote = (m->src_rank != g_tw_mynode);
+    int level = m->level < OLSR_MAX_LEVELS ? m->level : OLSR_MAX_LEVELS - 1;
+    
+    st->pair_events[pair] += dir;
+    if (remote) {
+        st->remote[m->type] += dir;
+        st->pair_remote[pair] += dir;
+    }
+    
+    if (m->type == SA_MASTER_RX) {
+        st->level_events[level] += dir;
+        if (remote) {
+            st->level_remote[level] += dir;
+        }
+    }
+}
+
+/**
+ * SA masters hear from the nodes of their region at level 0 and from
+ * other masters above that
+ */
+static inline olsr_pair sa_master_pair(olsr_msg_data *m)
+{
+    return (m->type == SA_MASTER_RX && m->level > 0) ?
+        OLSR_PAIR_MASTER_MASTER : OLSR_PAIR_NODE_MASTER;
+}
+
+/**
+ * Raise the high-water mark of the PE's event pool.  Whatever is not on
+ * the free list is in use, including processed events that have not been
+ * fossil collected yet.  A rollback does not give back the memory it used,
+ * so this is not undone.
+ */
+static inline void count_events_in_use(tw_lp *lp)
+{
+    unsigned long avail = lp->pe->free_q.size;
+    
+    if (avail < g_tw_events_per_pe &&
+        g_tw_events_per_pe - avail > g_olsr_stats.events_peak) {
+        g_olsr_stats.events_peak = g_tw_events_per_pe - avail;
+    }
+}
+
+static void olsr_event_handler(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp);
+static void sa_master_event_handler(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp);
+
+/**
+ * Forward handler for OLSR nodes: olsr_event_handler(), traced and timed
+ * if those are on
+ */
+void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    OLSR_TRACE(lp, m, OLSR_TRACE_FORWARD);
+    count_delivery(m, OLSR_PAIR_NODE_NODE, 1);
+    count_events_in_use(lp);
+#if OLSR_TIMING
+    g_olsr_stats.cost_type = m->type;
+#endif
+    OLSR_TIME_BEGIN(t);
+    olsr_event_handler(s, bf, m, lp);
+    OLSR_TIME_END(t, OLSR_COST_HANDLER);
+}
+
+/**
+ * Forward handler for SA masters: sa_master_event_handler(), traced and
+ * timed if those are on
+ */
+void sa_master_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    OLSR_TRACE(lp, m, OLSR_TRACE_FORWARD);
+    count_delivery(m, sa_master_pair(m), 1);
+    count_events_in_use(lp);
+#if OLSR_TIMING
+    g_olsr_stats.cost_type = m->type;
+#endif
+    OLSR_TIME_BEGIN(t);
+    sa_master_event_handler(s, bf, m, lp);
+    OLSR_TIME_END(t, OLSR_COST_HANDLER);
+}
+
 /**
  * Event handler.  Basically covers two events at the moment:
  * - HELLO_TX: HELLO transmit required now, so package up all of our
@@ -839,74 +1739,53 @@ void process_sa(node_state *s, olsr_msg_data *m)
  * - TC_TX: Similar to HELLO_TX but for Topology Control
  * - TC_RX: Similar to HELLO_RX but for Topology Control
  */
-void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+static void olsr_event_handler(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
 {
     int in;
-    int i, j, k;
-    int is_mpr;
+    int i, j;
     TC *t;
     hello *h;
     tw_event *e;
     tw_stime ts;
     tw_lp *cur_lp;
     olsr_msg_data *msg;
+    olsr_msg_data out;
+    RT_entry *route;
+    neigh_tuple *nt;
+    o_local self;
+    o_local orig;
+    olsr_mask heard;
+    olsr_mask added;
+    olsr_mask advertised;
     //latlng *ll;
     //latlng_cluster *llc;
 
 #if DEBUG
-    fprintf( olsr_event_log, "OLSR Event: LP %d Type %d at TS = %lf RNGs:", lp->gid, m->type, tw_now(lp) );
-    rng_write_state( lp->rng, olsr_event_log );
-    
     if( lp->gid == 1023 ) {
         printf("LP DUMP Node %llu on Rank %d at TS=%lf: S Local Address = %llu, M Type = %d,M Sender = %llu, M Originator = %llu \n", 
                lp->gid, g_tw_mynode, tw_now(lp), s->local_address, m->type, m->sender, m->originator );
     }
 #endif /* DEBUG */
 
-#if ENABLE_OPTIMISTIC
-    if( g_tw_synchronization_protocol == OPTIMISTIC )
-      {
-	memcpy( &(m->state_copy), s, sizeof(node_state));
-      }
-#endif 
-
-    g_olsr_event_stats[m->type]++;
+    g_olsr_stats.events[m->type]++;
+    olsr_delta_begin(s, m, lp);
+    expire_tuples(s, bf, m, lp);
     
     switch(m->type) {
         case HELLO_TX:
         {
-            ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
-            
-            cur_lp = tw_getlocal_lp(region(s->local_address)*OLSR_MAX_NEIGHBORS);
-            
-            e = tw_event_new(cur_lp->gid, ts, lp);
-            msg = tw_event_data(e);
-            msg->type = HELLO_RX;
-            msg->originator = m->originator;
-            msg->lng = s->lng;
-            msg->lat = s->lat;
-            msg->target = tw_getlocal_lp(region(s->local_address)*OLSR_MAX_NEIGHBORS)->gid;
-            h = &msg->mt.h;
-            h->num_neighbors = s->num_neigh;// + 1;
-            //h->neighbor_addrs[0] = s->local_address;
-            for (j = 0; j < s->num_neigh; j++) {
-                h->neighbor_addrs[j] = s->neighSet[j].neighborMainAddr;
-                // If s->neighSet[j].neighborMainAddr is our MPR, we need
-                // to set this appropriately
-                is_mpr = 0;
-                for (k = 0; k < s->num_mpr; k++) {
-                    if (s->mprSet[k] == s->neighSet[j].neighborMainAddr) {
-                        is_mpr = 1;
-                    }
-                }
-                if (is_mpr) {
-                    h->is_mpr[j] = 1;
-                }
-                else {
-                    h->is_mpr[j] = 0;
-                }
+            memset(&out, 0, sizeof(out));
+            out.type = HELLO_RX;
+            out.originator = m->originator;
+            out.lng = s->lng;
+            out.lat = s->lat;
+            h = &out.mt.h;
+            h->neighbors = s->neigh_mask;
+            if (mpr_current(s)) {
+                bf->c1 = 1;
             }
-            tw_event_send(e);
+            h->mprs = s->mpr_mask;
+            olsr_broadcast(s, &out, lp);
             
             e = tw_event_new(lp->gid, HELLO_INTERVAL, lp);
             msg = tw_event_data(e);
@@ -915,9 +1794,9 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             msg->lng = s->lng;
             msg->lat = s->lat;
             h = &msg->mt.h;
-            h->num_neighbors = 0;//1;
-            //h->neighbor_addrs[0] = s->local_address;
-            tw_event_send(e);
+            h->neighbors = 0;
+            h->mprs = 0;
+            olsr_event_send(e);
             
             break;
         }
@@ -925,14 +1804,14 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
         {
             h = &m->mt.h;
             
-            in = 0;
-            
             // If we receive our own message, don't add ourselves but
             // DO generate a new event for the next guy!
             
             // Copy the message we just received; we can't add data to
             // a message sent by another node
-            if (m->target < region(s->local_address)*OLSR_MAX_NEIGHBORS+OLSR_MAX_NEIGHBORS-1) {
+            if (!olsr_fanout() &&
+                m->target < region(s->local_address)*OLSR_MAX_NEIGHBORS+OLSR_MAX_NEIGHBORS-1) {
+                bf->c0 = 1;
                 ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
                 
                 tw_lp *cur_lp = tw_getlocal_lp(m->target + 1);
@@ -945,14 +1824,10 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 msg->lng = m->lng;
                 msg->lat = m->lat;
                 msg->target = m->target + 1;
-                h = &msg->mt.h;
-                h->num_neighbors = m->mt.h.num_neighbors;//m->num_neigh + 1;
-                //h->neighbor_addrs[0] = s->local_address;
-                for (j = 0; j < h->num_neighbors; j++) {
-                    h->neighbor_addrs[j] = m->mt.h.neighbor_addrs[j];
-                    //h->neighbor_addrs[j] = s->neighSet[j].neighborMainAddr;
-                }
-                tw_event_send(e);
+                // Payloads are a few dozen bytes at most, one copy
+                // is cheaper than sharing them between hops
+                msg->mt.h = m->mt.h;
+                olsr_event_send(e);
             }
             
             // We've already passed along the message which has to happen
@@ -968,332 +1843,124 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 return;
             }
             
-            // BEGIN 1-HOP PROCESSING
-            for (i = 0; i < s->num_neigh; i++) {
-                if (s->neighSet[i].neighborMainAddr == m->originator) {
-                    in = 1;
-                }
-            }
+            assert(region(s->local_address) == region(m->originator));
+            self = OLSR_LOCAL(s->local_address);
+            orig = OLSR_LOCAL(m->originator);
             
-            if (!in) {
-                s->neighSet[s->num_neigh].neighborMainAddr = m->originator;
+            // BEGIN 1-HOP PROCESSING
+            bf->c6 = 1;
+            
+            nt = FindSymNeighborTuple(s, orig);
+            
+            if (nt == NULL) {
+                bf->c5 = 1;
+                bf->c7 = 1;
+                OLSR_SAVE(s, s->neighSet[s->num_neigh]);
+                OLSR_SAVE(s, s->num_neigh);
+                OLSR_SAVE(s, s->ansn);
+                OLSR_SAVE(s, s->neigh_mask);
+                OLSR_UNDO(m->undo.rx.hello.neigh = s->neighSet[s->num_neigh];
+                          m->undo.rx.hello.neigh_from = s->neigh_from[s->num_neigh]);
+                nt = &s->neighSet[s->num_neigh];
+                nt->neighborMainAddr = orig;
                 s->num_neigh++;
+                s->neigh_mask |= OLSR_MASK_BIT(orig);
                 assert(s->num_neigh < OLSR_MAX_NEIGHBORS);
-                assert(region(s->local_address) == region(m->originator));
                 s->ansn++;
             }
+            else {
+                OLSR_SAVE(s, nt->expirationTime);
+                OLSR_UNDO(m->undo.rx.hello.neigh = *nt);
+            }
+            
+            nt->expirationTime = tw_now(lp) + NEIGHB_HOLD_TIME;
+            OLSR_UNDO(m->undo.rx.hello.wheel[0] = *wheel_slot_at(s->wheel_neigh, nt->expirationTime));
+            wheel_add(s, s->wheel_neigh, orig, nt->expirationTime);
             // END 1-HOP PROCESSING
             
             // BEGIN 2-HOP PROCESSING
             
             h = &m->mt.h;
             
-            for (i = 0; i < h->num_neighbors; i++) {
-                if (s->local_address == h->neighbor_addrs[i]) {
-                    // We are not going to be our own 2-hop neighbor!
-                    continue;
-                }
-                
-                // Check and see if h->neighbor_addrs[i] is in our list
-                // already
-                in = 0;
+            // We are not going to be our own 2-hop neighbor!
+            heard = h->neighbors & ~OLSR_MASK_BIT(self);
+            assert(!(heard & OLSR_MASK_BIT(orig)));
+            added = heard & ~s->two_hop_mask[orig];
+            
+            // Refresh the tuples we already have through orig...
+            if (heard & s->two_hop_mask[orig]) {
                 for (j = 0; j < s->num_two_hop; j++) {
-                    if (s->twoHopSet[j].neighborMainAddr == m->originator &&
-                        s->twoHopSet[j].twoHopNeighborAddr == h->neighbor_addrs[i]) {
-                        in = 1;
+                    if (s->twoHopSet.neighborMainAddr[j] == orig &&
+                        (heard & OLSR_MASK_BIT(s->twoHopSet.twoHopNeighborAddr[j]))) {
+                        OLSR_SAVE(s, s->twoHopSet.expirationTime[j]);
+                        OLSR_UNDO(m->undo.rx.hello.two_hop[s->twoHopSet.twoHopNeighborAddr[j]].expirationTime =
+                                  s->twoHopSet.expirationTime[j]);
+                        s->twoHopSet.expirationTime[j] = tw_now(lp) + NEIGHB_HOLD_TIME;
                     }
                 }
-                
-                if (!in) {
-                    s->twoHopSet[s->num_two_hop].neighborMainAddr = m->originator;
-                    s->twoHopSet[s->num_two_hop].twoHopNeighborAddr = h->neighbor_addrs[i];
-                    assert(s->twoHopSet[s->num_two_hop].neighborMainAddr !=
-                           s->twoHopSet[s->num_two_hop].twoHopNeighborAddr);
-                    s->num_two_hop++;
-                    assert(s->num_two_hop < OLSR_MAX_2_HOP);
-                }
-            }
-            
-            // END 2-HOP PROCESSING
-            
-            // BEGIN MPR COMPUTATION
-            
-            // Initially no nodes are covered
-            memset(g_covered, 0, BITNSLOTS(OLSR_MAX_NEIGHBORS));
-            s->num_mpr = 0;
-            
-            // Copy all relevant information to scratch space
-            g_num_one_hop = s->num_neigh;
-            for (i = 0; i < g_num_one_hop; i++) {
-                g_mpr_one_hop[i] = s->neighSet[i];
             }
             
-            g_num_two_hop = s->num_two_hop;
-            for (i = 0; i < g_num_two_hop; i++) {
-                g_mpr_two_hop[i] = s->twoHopSet[i];
+            // ...and add the ones we don't
+            OLSR_UNDO(m->undo.rx.hello.two_hop_mask = s->two_hop_mask[orig]);
+            if (added) {
+                bf->c7 = 1;
+                OLSR_SAVE(s, s->two_hop_mask[orig]);
+                s->two_hop_mask[orig] |= added;
             }
             
-            // Calculate D(y), where y is a member of N, for all nodes in N
-            for (i = 0; i < g_num_one_hop; i++) {
-                g_Dy[i] = Dy(s, g_mpr_one_hop[i].neighborMainAddr);
-                g_reachability[i] = 0;
+            for (; added; added &= added - 1) {
+                j = s->num_two_hop;
+                OLSR_SAVE(s, s->twoHopSet.neighborMainAddr[j]);
+                OLSR_SAVE(s, s->twoHopSet.twoHopNeighborAddr[j]);
+                OLSR_SAVE(s, s->twoHopSet.expirationTime[j]);
+                OLSR_SAVE(s, s->num_two_hop);
+                OLSR_UNDO(two_hop_save(s, j, &m->undo.rx.hello.two_hop[olsr_ctz(added)]));
+                s->twoHopSet.neighborMainAddr[j] = orig;
+                s->twoHopSet.twoHopNeighborAddr[j] = olsr_ctz(added);
+                s->twoHopSet.expirationTime[j] = tw_now(lp) + NEIGHB_HOLD_TIME;
+                s->num_two_hop++;
+                assert(s->num_two_hop < OLSR_MAX_2_HOP);
             }
             
-            // Take care of the "unused" bits
-//            for (i = g_num_two_hop; i < OLSR_MAX_2_HOP; i++) {
-//                BITSET(g_covered, i);
-//            }
-            
-//            // 2. Calculate D(y), where y is a member of N, for all nodes in N.
-//            for (i = 0; i < g_num_one_hop; i++) {
-//                g_Dy[i] = Dy(s, s->neighSet[i].neighborMainAddr);
-//            }
-            
-            // 3. Add to the MPR set those nodes in N, which are the *only*
-            // nodes to provide reachability to a node in N2.
-//            std::set<Ipv4Address> coveredTwoHopNeighbors;
-//            for (TwoHopNeighborSet::const_iterator twoHopNeigh = N2.begin (); twoHopNeigh != N2.end (); twoHopNeigh++)
-//            {
-//                bool onlyOne = true;
-//                // try to find another neighbor that can reach twoHopNeigh->twoHopNeighborAddr
-//                for (TwoHopNeighborSet::const_iterator otherTwoHopNeigh = N2.begin (); otherTwoHopNeigh != N2.end (); otherTwoHopNeigh++)
-//                {
-//                    if (otherTwoHopNeigh->twoHopNeighborAddr == twoHopNeigh->twoHopNeighborAddr
-//                        && otherTwoHopNeigh->neighborMainAddr != twoHopNeigh->neighborMainAddr)
-//                    {
-//                        onlyOne = false;
-//                        break;
-//                    }
-//                }
-//                if (onlyOne)
-//                {
-//                    NS_LOG_LOGIC ("Neighbor " << twoHopNeigh->neighborMainAddr
-//                                  << " is the only that can reach 2-hop neigh. "
-//                                  << twoHopNeigh->twoHopNeighborAddr
-//                                  << " => select as MPR.");
-//                    
-//                    mprSet.insert (twoHopNeigh->neighborMainAddr);
-//                    
-//                    // take note of all the 2-hop neighbors reachable by the newly elected MPR
-//                    for (TwoHopNeighborSet::const_iterator otherTwoHopNeigh = N2.begin ();
-//                         otherTwoHopNeigh != N2.end (); otherTwoHopNeigh++)
-//                    {
-//                        if (otherTwoHopNeigh->neighborMainAddr == twoHopNeigh->neighborMainAddr)
-//                        {
-//                            coveredTwoHopNeighbors.insert (otherTwoHopNeigh->twoHopNeighborAddr);
-//                        }
-//                    }
-//                }
-//            }
+            OLSR_UNDO(m->undo.rx.hello.wheel[1] =
+                      *wheel_slot_at(s->wheel_two_hop, tw_now(lp) + NEIGHB_HOLD_TIME));
+            wheel_add(s, s->wheel_two_hop, orig, tw_now(lp) + NEIGHB_HOLD_TIME);
             
-            for (i = 0; i < g_num_two_hop; i++) {
-                int onlyOne = 1;
-                // try to find another neighbor that can reach twoHopNeigh->twoHopNeighborAddr
-                for (j = 0; j < g_num_two_hop; j++) {
-                    if (g_mpr_two_hop[j].twoHopNeighborAddr == g_mpr_two_hop[i].twoHopNeighborAddr
-                        && g_mpr_two_hop[j].neighborMainAddr != g_mpr_two_hop[i].neighborMainAddr) {
-                        onlyOne = 0;
-                        break;
-                    }
-                }
-                
-                if (onlyOne) {
-                    s->mprSet[s->num_mpr] = g_mpr_two_hop[i].neighborMainAddr;
-                    s->num_mpr++;
-                    assert(s->num_mpr < OLSR_MAX_NEIGHBORS);
-                    // Make sure they're all unique!
-                    mpr_set_uniq(s);
-                    
-                    // take note of all the 2-hop neighbors reachable by the newly elected MPR
-                    for (j = 0; j < g_num_two_hop; j++) {
-                        if (g_mpr_two_hop[j].neighborMainAddr == g_mpr_two_hop[i].neighborMainAddr) {
-                            //coveredTwoHopNeighbors.insert (otherTwoHopNeigh->twoHopNeighborAddr);
-                            // We don't do that, we use bitfields.  Make sure
-                            // our assumptions are correct then create a mask
-                            //printf("%lu\n", g_mpr_two_hop[j].neighborMainAddr);
-                            assert(region(g_mpr_two_hop[j].neighborMainAddr) == region(s->local_address));
-                            BITSET(g_covered, g_mpr_two_hop[j].twoHopNeighborAddr % OLSR_MAX_NEIGHBORS);
-                        }
-                    }
-                }
-            }
+            // END 2-HOP PROCESSING
             
-//            // Remove the nodes from N2 which are now covered by a node in the MPR set.
-//            for (TwoHopNeighborSet::iterator twoHopNeigh = N2.begin ();
-//                 twoHopNeigh != N2.end (); )
-//            {
-//                if (coveredTwoHopNeighbors.find (twoHopNeigh->twoHopNeighborAddr) != coveredTwoHopNeighbors.end ())
-//                {
-//                    // This works correctly only because it is known that twoHopNeigh is reachable by exactly one neighbor, 
-//                    // so only one record in N2 exists for each of them. This record is erased here.
-//                    NS_LOG_LOGIC ("2-hop neigh. " << twoHopNeigh->twoHopNeighborAddr << " is already covered by an MPR.");
-//                    twoHopNeigh = N2.erase (twoHopNeigh);
-//                }
-//                else
-//                {
-//                    twoHopNeigh++;
-//                }
-//            }
-            // Remove the nodes from N2 which are now covered by a node in the MPR set.
-            for (i = 0; i < g_num_two_hop; i++) {
-                if (BITTEST(g_covered, g_mpr_two_hop[i].twoHopNeighborAddr % OLSR_MAX_NEIGHBORS)) {
-                    //printf("1. g_num_two_hop is %d\n", g_num_two_hop);
-                    remove_node_from_n2(g_mpr_two_hop[i].twoHopNeighborAddr);
-                    //printf("2. g_num_two_hop is %d\n", g_num_two_hop);
+            // The MPR set only depends on the 1-hop and 2-hop sets, so
+            // a HELLO that added nothing to either cannot change it.  One
+            // that did leaves it to be rebuilt at our next HELLO_TX,
+            // together with whatever else we hear before then.
+            if (bf->c7) {
+                if (s->mpr_dirty) {
+                    // Already waiting for a rebuild; this HELLO shares it
+                    bf->c15 = 1;
+                    g_olsr_stats.mpr_avoided++;
                 }
+                mpr_changed(s);
+                routes_changed(s);
             }
-            
-            //return;
-            
-//            // 4. While there exist nodes in N2 which are not covered by at
-//            // least one node in the MPR set:
-//            while (N2.begin () != N2.end ())
-            //printf("\n\n");
-            while (g_num_two_hop) {
-                //printf(".");
-//                // 4.1. For each node in N, calculate the reachability, i.e., the
-//                // number of nodes in N2 which are not yet covered by at
-//                // least one node in the MPR set, and which are reachable
-//                // through this 1-hop neighbor
-//                std::map<int, std::vector<const NeighborTuple *> > reachability;
-//                std::set<int> rs;
-//                for (NeighborSet::iterator it = N.begin (); it != N.end (); it++)
-//                {
-//                    NeighborTuple const &nb_tuple = *it;
-//                    int r = 0;
-//                    for (TwoHopNeighborSet::iterator it2 = N2.begin (); it2 != N2.end (); it2++)
-//                    {
-//                        TwoHopNeighborTuple const &nb2hop_tuple = *it2;
-//                        if (nb_tuple.neighborMainAddr == nb2hop_tuple.neighborMainAddr)
-//                            r++;
-//                    }
-//                    rs.insert (r);
-//                    reachability[r].push_back (&nb_tuple);
-//                }
-                
-                for (i = 0; i < g_num_one_hop; i++) {
-                    int r = 0;
-                    
-                    for (j = 0; j < g_num_two_hop; j++) {
-                        if (g_mpr_one_hop[i].neighborMainAddr == g_mpr_two_hop[j].neighborMainAddr)
-                            r++;
-                    }
-                    // Make sure our neighbors are from our region
-                    assert(region(g_mpr_one_hop[i].neighborMainAddr) == region(s->local_address));
-                    g_reachability[i] = r;
-                }
-                
-//                // 4.2. Select as a MPR the node with highest N_willingness among
-//                // the nodes in N with non-zero reachability. In case of
-//                // multiple choice select the node which provides
-//                // reachability to the maximum number of nodes in N2. In
-//                // case of multiple nodes providing the same amount of
-//                // reachability, select the node as MPR whose D(y) is
-//                // greater. Remove the nodes from N2 which are now covered
-//                // by a node in the MPR set.
-//                NeighborTuple const *max = NULL;
-//                int max_r = 0;
-//                for (std::set<int>::iterator it = rs.begin (); it != rs.end (); it++)
-//                {
-//                    int r = *it;
-//                    if (r == 0)
-//                    {
-//                        continue;
-//                    }
-//                    for (std::vector<const NeighborTuple *>::iterator it2 = reachability[r].begin ();
-//                         it2 != reachability[r].end (); it2++)
-//                    {
-//                        const NeighborTuple *nb_tuple = *it2;
-//                        if (max == NULL || nb_tuple->willingness > max->willingness)
-//                        {
-//                            max = nb_tuple;
-//                            max_r = r;
-//                        }
-//                        else if (nb_tuple->willingness == max->willingness)
-//                        {
-//                            if (r > max_r)
-//                            {
-//                                max = nb_tuple;
-//                                max_r = r;
-//                            }
-//                            else if (r == max_r)
-//                            {
-//                                if (Degree (*nb_tuple) > Degree (*max))
-//                                {
-//                                    max = nb_tuple;
-//                                    max_r = r;
-//                                }
-//                            }
-//                        }
-//                    }
-//                }
-                
-                int max = 0;
-                int max_Dy = 0;
-                
-                for (i = 0; i < g_num_one_hop; i++) {
-                    if (g_reachability[i] == 0) continue;
-                    
-                    if (g_reachability[i] > max) {
-                        max = g_reachability[i];
-                        g_mpr_neigh_to_add = g_mpr_one_hop[i];
-                        max_Dy = g_Dy[i];
-                    }
-                    else if (g_reachability[i] == max) {
-                        if (g_Dy[i] > max_Dy) {
-                            max = g_reachability[i];
-                            g_mpr_neigh_to_add = g_mpr_one_hop[i];
-                            max_Dy = g_Dy[i];
-                        }
-                    }
-                }
-                
-                if (max > 0) {
-                    s->mprSet[s->num_mpr] = g_mpr_neigh_to_add.neighborMainAddr;
-                    s->num_mpr++;
-                    assert(s->num_mpr < OLSR_MAX_NEIGHBORS);
-                    // Make sure they're all unique!
-                    mpr_set_uniq(s);
-                    
-                    // take note of all the 2-hop neighbors reachable by the newly elected MPR
-                    for (j = 0; j < g_num_two_hop; j++) {
-                        if (g_mpr_two_hop[j].neighborMainAddr == g_mpr_neigh_to_add.neighborMainAddr) {
-                            //coveredTwoHopNeighbors.insert (otherTwoHopNeigh->twoHopNeighborAddr);
-                            // We don't do that, we use bitfields.  Make sure
-                            // our assumptions are correct then create a mask
-                            assert(region(g_mpr_two_hop[j].neighborMainAddr) == region(s->local_address));
-                            BITSET(g_covered, g_mpr_two_hop[j].twoHopNeighborAddr % OLSR_MAX_NEIGHBORS);
-                        }
-                    }
-                }
-                
-                // Remove the nodes from N2 which are now covered by a node in the MPR set.
-                for (i = 0; i < g_num_two_hop; i++) {
-                    if (BITTEST(g_covered, g_mpr_two_hop[i].twoHopNeighborAddr % OLSR_MAX_NEIGHBORS)) {
-                        //printf("1. g_num_two_hop is %d\n", g_num_two_hop);
-                        remove_node_from_n2(g_mpr_two_hop[i].twoHopNeighborAddr);
-                        //printf("2. g_num_two_hop is %d\n", g_num_two_hop);
-                    }
-                }
-                
+            else {
+                g_olsr_stats.mpr_avoided++;
             }
             
-            // END MPR COMPUTATION
-            
             // BEGIN MPR SELECTOR SET
             
             h = &m->mt.h;
             
-            for (i = 0; i < h->num_neighbors; i++) {
-                if (h->is_mpr[i]) {
-                    // Check if it contains OUR address
-                    if (h->neighbor_addrs[i] == s->local_address) {
-                        // We should add this guy to the selector set
-                        s->mprSelSet[s->num_mpr_sel].mainAddr = m->originator;
-                        s->num_mpr_sel++;
-                        assert(s->num_mpr_sel <= OLSR_MAX_NEIGHBORS);
-                        mpr_sel_set_uniq(s);
-                    }
+            if (h->mprs & OLSR_MASK_BIT(self)) {
+                // We should add this guy to the selector set
+                bf->c9 = 1;
+                OLSR_SAVE(s, s->mprSelSet[s->num_mpr_sel]);
+                OLSR_SAVE(s, s->num_mpr_sel);
+                OLSR_UNDO(m->undo.rx.hello.mpr_sel = s->mprSelSet[s->num_mpr_sel];
+                          m->undo.rx.hello.mpr_sel_from = s->mpr_sel_from[s->num_mpr_sel]);
+                s->mprSelSet[s->num_mpr_sel].mainAddr = orig;
+                s->num_mpr_sel++;
+                assert(s->num_mpr_sel <= OLSR_MAX_NEIGHBORS);
+                if (mpr_sel_set_uniq(s)) {
+                    bf->c10 = 1;
                 }
             }
             
@@ -1303,21 +1970,18 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
         }
         case TC_TX:
         {
-            // Might want to rename HELLO_DELTA...
-            ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
-            
-            cur_lp = tw_getlocal_lp(region(s->local_address)*OLSR_MAX_NEIGHBORS);
-            
-            e = tw_event_new(cur_lp->gid, ts, lp);
-            msg = tw_event_data(e);
-            msg->type = TC_RX;
-            msg->ttl = 255;
-            msg->originator = m->originator;
-            msg->sender = s->local_address;
-            msg->lng = s->lng;
-            msg->lat = s->lat;
-            msg->target = tw_getlocal_lp(region(s->local_address)*OLSR_MAX_NEIGHBORS)->gid;
-            t = &msg->mt.t;
+            OLSR_SAVE(s, s->msg_seq);
+            s->msg_seq++;
+            
+            memset(&out, 0, sizeof(out));
+            out.type = TC_RX;
+            out.ttl = 255;
+            out.originator = m->originator;
+            out.seq_num = s->msg_seq;
+            out.sender = s->local_address;
+            out.lng = s->lng;
+            out.lat = s->lat;
+            t = &out.mt.t;
             t->ansn = s->ansn;
             //t->num_mpr_sel = s->num_mpr_sel;
             t->num_neighbors = s->num_neigh;
@@ -1326,9 +1990,8 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             }
             //if (s->num_mpr_sel > 0) {
             //printTC(t);
-            tw_event_send(e);
+            olsr_broadcast(s, &out, lp);
             //}
-            //tw_event_send(e);
             
             e = tw_event_new(lp->gid, TC_INTERVAL, lp);
             msg = tw_event_data(e);
@@ -1340,7 +2003,7 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             //t->num_mpr_sel = 0;
             t->num_neighbors = 0;
             //printTC(t);
-            tw_event_send(e);
+            olsr_event_send(e);
             
             break;
         }
@@ -1357,12 +2020,15 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 return;
             }
             
+            bf->c3 = 1;
             m->ttl--;
             
             // Copy the message we just received; we can't add data to
             // a message sent by another node
             
-            if (m->target < region(s->local_address)*OLSR_MAX_NEIGHBORS+OLSR_MAX_NEIGHBORS-1) {
+            if (!olsr_fanout() &&
+                m->target < region(s->local_address)*OLSR_MAX_NEIGHBORS+OLSR_MAX_NEIGHBORS-1) {
+                bf->c0 = 1;
                 ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
                 
                 tw_lp *cur_lp = tw_getlocal_lp(m->target + 1);
@@ -1372,19 +2038,14 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 msg->type = TC_RX;
                 msg->ttl = m->ttl;
                 msg->originator = m->originator;
+                msg->seq_num = m->seq_num;
                 msg->sender = m->sender;
                 msg->lng = m->lng;
                 msg->lat = m->lat;
                 msg->target = m->target + 1;
-                t = &msg->mt.t;
-                t->ansn = m->mt.t.ansn;
-                //t->num_mpr_sel = m->mt.t.num_mpr_sel;
-                t->num_neighbors = m->mt.t.num_neighbors;
-                for (j = 0; j < t->num_neighbors; j++) {
-                    t->neighborAddresses[j] = m->mt.t.neighborAddresses[j];
-                }
+                msg->mt.t = m->mt.t;
                 //printTC(t);
-                tw_event_send(e);
+                olsr_event_send(e);
             }
             
             // We've already passed along the message which has to happen
@@ -1400,23 +2061,28 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 return;
             }
             
+            assert(region(s->local_address) == region(m->originator));
+            orig = OLSR_LOCAL(m->originator);
+            
             // BEGIN TC PROCESSING
 
             //int do_forwarding = 1;
-            dup_tuple *duplicated = FindDuplicateTuple(m->originator, m->seq_num, s);
+            OLSR_TIME_BEGIN(t_dup);
+            dup_tuple *duplicated = FindDuplicateTuple(orig, m->seq_num, s);
+            OLSR_TIME_END(t_dup, OLSR_COST_DUPS);
             
             if (duplicated != NULL) {
                 //break;
             }
             
-            ForwardDefault(m, duplicated, s->local_address, m->sender, s, lp);
+            ForwardDefault(m, duplicated, s->local_address, OLSR_LOCAL(m->sender), s, bf, lp);
             
             in = 0;
             
             // 1. If the sender interface of this message is not in the symmetric
             // 1-hop neighborhood of this node, the message MUST be discarded.
             for (i = 0; i < s->num_neigh; i++) {
-                if (m->sender == s->neighSet[i].neighborMainAddr)
+                if (OLSR_LOCAL(m->sender) == s->neighSet[i].neighborMainAddr)
                     in = 1;
             }
             
@@ -1428,50 +2094,61 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             //    T_seq       >  ANSN,
             // then further processing of this TC message MUST NOT be
             // performed.
-            top_tuple *tt = FindNewerTopologyTuple(m->originator, m->mt.t.ansn, s);
-            if (tt != NULL)
+            int tt = FindNewerTopologyTuple(orig, m->mt.t.ansn, s);
+            if (tt >= 0)
                 return;
             
+            bf->c13 = 1;
+            OLSR_UNDO(m->undo.rx.tc.destAddr = s->topSet.destAddr[orig];
+                      m->undo.rx.tc.top_removed = s->top_removed[orig];
+                      m->undo.rx.tc.sequenceNumber = s->topSet.sequenceNumber[orig];
+                      m->undo.rx.tc.expirationTime = s->topSet.expirationTime[orig];
+                      m->undo.rx.tc.wheel = *wheel_slot_at(s->wheel_top, tw_now(lp) + TOP_HOLD_TIME));
+            
             // 3. All tuples in the topology set where:
             //	T_last_addr == originator address AND
             //	T_seq       <  ANSN
             // MUST be removed from the topology set.
-            EraseOlderTopologyTuples(m->originator, m->mt.t.ansn, s);
+            EraseOlderTopologyTuples(orig, m->mt.t.ansn, s);
             
             printTC(m, s);
             
             // 4. For each of the advertised neighbor main address received in
             // the TC message:
+            advertised = 0;
             for (i = 0; i < m->mt.t.num_neighbors; i++) {
-                o_addr addr = m->mt.t.neighborAddresses[i];
-                // 4.1. If there exist some tuple in the topology set where:
-                //        T_dest_addr == advertised neighbor main address, AND
-                //        T_last_addr == originator address,
-                // then the holding time of that tuple MUST be set to:
-                //        T_time      =  current time + validity time.
-                tt = FindTopologyTuple(addr, m->originator, s);
-                
-                if (tt != NULL) {
-#warning "Correct this line - TOP_HOLD_TIME should be in the struct!"
-                    tt->expirationTime = tw_now(lp) + TOP_HOLD_TIME;
-                }
-                else {
-                    // 4.2. Otherwise, a new tuple MUST be recorded in the topology
-                    // set where:
-                    //	T_dest_addr = advertised neighbor main address,
-                    //	T_last_addr = originator address,
-                    //	T_seq       = ANSN,
-                    //	T_time      = current time + validity time.
-                    s->topSet[s->num_top_set].destAddr = addr;
-                    s->topSet[s->num_top_set].lastAddr = m->originator;
-                    s->topSet[s->num_top_set].sequenceNumber = m->mt.t.ansn;
+                advertised |= OLSR_MASK_BIT(m->mt.t.neighborAddresses[i]);
+            }
+            
+            // 4.1. If there exist some tuple in the topology set where:
+            //        T_dest_addr == advertised neighbor main address, AND
+            //        T_last_addr == originator address,
+            // then the holding time of that tuple MUST be set to:
+            //        T_time      =  current time + validity time.
+            // 4.2. Otherwise, a new tuple MUST be recorded in the topology
+            // set where:
+            //	T_dest_addr = advertised neighbor main address,
+            //	T_last_addr = originator address,
+            //	T_seq       = ANSN,
+            //	T_time      = current time + validity time.
+            // After step 3 whatever is left in the row has T_seq == ANSN,
+            // so both come down to replacing the row.
+            if (advertised & ~s->topSet.destAddr[orig]) {
+                OLSR_SAVE(s, s->topSet.destAddr[orig]);
+                routes_changed(s);
+                s->topSet.destAddr[orig] |= advertised;
+            }
+            
+            if (advertised) {
+                OLSR_SAVE(s, s->topSet.sequenceNumber[orig]);
+                OLSR_SAVE(s, s->topSet.expirationTime[orig]);
+                s->topSet.sequenceNumber[orig] = m->mt.t.ansn;
 #warning "Correct this line - TOP_HOLD_TIME should be in the struct!"
-                    s->topSet[s->num_top_set].expirationTime = tw_now(lp) + TOP_HOLD_TIME;
-                    s->num_top_set++;
-                    assert(s->num_top_set < OLSR_MAX_TOP_TUPLES);
-                }
+                s->topSet.expirationTime[orig] = tw_now(lp) + TOP_HOLD_TIME;
             }
             
+            wheel_add(s, s->wheel_top, orig, tw_now(lp) + TOP_HOLD_TIME);
+            
             // END TC PROCESSING
             
             
@@ -1494,27 +2171,31 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             msg->destination = MASTER_NODE;
             msg->lng = s->lng;
             msg->lat = s->lat;
-            tw_event_send(e);
+            olsr_event_send(e);
             
             
             // Check and see if we are the destination...
             if (m->destination == s->local_address) {
                 // This is the final stop
+                bf->c14 = 1;
                 process_sa(s, m);
                 return;
             }
             
             // Might want to rename HELLO_DELTA...
+            bf->c2 = 1;
             ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
             
             cur_lp = tw_getlocal_lp(region(s->local_address)*OLSR_MAX_NEIGHBORS);
             
             // If we don't have a route, don't allocate an event!
-            if (Lookup(s, MASTER_NODE) == NULL) {
+            if ((route = Lookup(s, MASTER_NODE)) == NULL) {
                 return;
             }
             
-            e = tw_event_new(cur_lp->gid, ts, lp);
+            // A unicast only has one receiver worth delivering to in
+            // fan-out mode: the next hop
+            e = tw_event_new(olsr_fanout() ? OLSR_GLOBAL(s->local_address, route->nextAddr) : cur_lp->gid, ts, lp);
             msg = tw_event_data(e);
             msg->type = SA_RX;
             msg->ttl = 255;
@@ -1546,6 +2227,7 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             // Check and see if we are the destination...
             if (m->destination == s->local_address) {
                 // This is the final stop
+                bf->c14 = 1;
                 process_sa(s, m);
                 return;
             }
@@ -1553,7 +2235,9 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             // Copy the message we just received; we can't add data to
             // a message sent by another node
             
-            if (m->target < region(s->local_address)*OLSR_MAX_NEIGHBORS+OLSR_MAX_NEIGHBORS-1) {
+            if (!olsr_fanout() &&
+                m->target < region(s->local_address)*OLSR_MAX_NEIGHBORS+OLSR_MAX_NEIGHBORS-1) {
+                bf->c0 = 1;
                 ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
                 
                 tw_lp *cur_lp = tw_getlocal_lp(m->target + 1);
@@ -1568,15 +2252,9 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 msg->lng = m->lng;
                 msg->lat = m->lat;
                 msg->target = m->target + 1;
-                t = &msg->mt.t;
-                t->ansn = m->mt.t.ansn;
-                //t->num_mpr_sel = m->mt.t.num_mpr_sel;
-                t->num_neighbors = m->mt.t.num_neighbors;
-                for (j = 0; j < t->num_neighbors; j++) {
-                    t->neighborAddresses[j] = m->mt.t.neighborAddresses[j];
-                }
+                msg->mt.t = m->mt.t;
                 //printTC(t);
-                tw_event_send(e);
+                olsr_event_send(e);
             }
             
             // We've already passed along the message which has to happen
@@ -1594,12 +2272,13 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             
             if (m->sender == s->local_address) {
                 // If we don't have a route, don't allocate an event!
-                if (Lookup(s, MASTER_NODE) == NULL) {
+                if ((route = Lookup(s, MASTER_NODE)) == NULL) {
                     return;
                 }
                 
+                bf->c2 = 1;
                 ts = g_tw_lookahead + tw_rand_unif(lp->rng) * HELLO_DELTA;
-                e = tw_event_new(lp->gid, ts, lp);
+                e = tw_event_new(olsr_fanout() ? OLSR_GLOBAL(s->local_address, route->nextAddr) : lp->gid, ts, lp);
                 msg = tw_event_data(e);
                 msg->type = SA_RX;
                 msg->ttl = m->ttl;
@@ -1629,7 +2308,7 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 msg->destination = sa_master_for_level(lp->gid, 0);
                 msg->lng = s->lng;
                 msg->lat = s->lat;
-                tw_event_send(e);
+                olsr_event_send(e);
             }
 #endif
         case SA_MASTER_TX:
@@ -1649,7 +2328,7 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             msg->destination = sa_master_for_level(lp->gid);
             msg->lng = s->lng;
             msg->lat = s->lat;
-            tw_event_send(e);
+            olsr_event_send(e);
             
             // Send a new SA_MASTER_RX to an SA Master
             ts = 1.0 + tw_rand_unif(lp->rng);
@@ -1660,13 +2339,8 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             msg->sender = s->local_address;
             msg->destination = sa_master_for_level(lp->gid);
             msg->level = 0;
-
-#if DEBUG
-	    fprintf(olsr_event_log, "Send Event OLSR LP %d to SA %d, Type %d at TS = %lf \n", 
-		    lp->gid, sa_master_for_level(lp->gid), m->type, ts );
-#endif
             
-            tw_event_send(e);
+            olsr_event_send(e);
             
 //            for (i = 0; i < total_regions; i++) {
 //                if (s->local_address == total_nodes + i) {
@@ -1706,8 +2380,8 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
         {
             //printf("Changing our location to %f, %f\n",
             //       m->lng, m->lat);
-            s->lng = m->lng;
-            s->lat = m->lat;
+            swap_position(s, m);
+            region_grid_place(s->local_address, s->lng, s->lat);
             
             // Build our initial RWALK_CHANGE messages
             ts = tw_rand_unif(lp->rng) * RWALK_INTERVAL + 1.0;
@@ -1716,19 +2390,17 @@ void olsr_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             msg->type = RWALK_CHANGE;
             msg->lng = tw_rand_unif(lp->rng) * GRID_MAX;
             msg->lat = tw_rand_unif(lp->rng) * GRID_MAX;
-            tw_event_send(e);
+            olsr_event_send(e);
         }
             
         default:
             return;
     }
-    
-    RoutingTableComputation(s);
 }
 
 tw_peid olsr_map(tw_lpid gid);
 
-void sa_master_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+static void sa_master_event_handler(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
 {
 //    int i;
     tw_stime ts;
@@ -1739,12 +2411,7 @@ void sa_master_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
 //    int total_nodes = SA_range_start * tw_nnodes();
 //    int total_regions = total_nodes / OLSR_MAX_NEIGHBORS;
 
-#if DEBUG
-    fprintf( olsr_event_log, "SA Master Event: LP %d Type %d at TS = %lf RNGs:", lp->gid, m->type, tw_now(lp) );
-    rng_write_state( lp->rng, olsr_event_log );
-#endif
-    
-    g_olsr_event_stats[m->type]++;
+    g_olsr_stats.events[m->type]++;
     
     switch (m->type) {
         case SA_MASTER_TX:
@@ -1775,6 +2442,7 @@ void sa_master_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
             //if (log2((nlp_per_pe - SA_range_start) * tw_nnodes()) > m->level) {
             if (x > m->level) {
                 // Send a new SA_MASTER_RX to an SA Master
+                bf->c0 = 1;
                 ts = 1.0 + tw_rand_unif(lp->rng);
                 dest = master_hierarchy(lp->gid, m->level+1);
 #if DEBUG    
@@ -1791,7 +2459,7 @@ void sa_master_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
                 msg->sender = s->local_address;
                 msg->destination = dest;
                 msg->level = m->level + 1;
-                tw_event_send(e);
+                olsr_event_send(e);
             }
             
             
@@ -1815,20 +2483,330 @@ void sa_master_event(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
     }
 }
 
+#if OLSR_REVERSE
+/// Swap back what expire_tuples() removed, newest first within each set
+static void expire_tuples_reverse(node_state *s, olsr_msg_data *m)
+{
+    expire_undo *u = &m->undo.expire;
+    olsr_mask top;
+    int i;
+    
+    for (i = 0; i < u->num_mpr_sel; i++) {
+        unremove_mpr_sel(s);
+    }
+    
+    for (i = 0; i < u->num_two_hop; i++) {
+        unremove_two_hop(s);
+    }
+    
+    for (i = 0; i < u->num_neigh; i++) {
+        unremove_neighbor(s);
+    }
+    s->ansn -= u->num_neigh;
+    
+    for (top = u->top; top; top &= top - 1) {
+        i = olsr_ctz(top);
+        s->topSet.destAddr[i] = s->top_removed[i];
+    }
+    
+    s->wheel_next = u->wheel_next;
+}
+
+/// Undo a HELLO_RX that was heard (bf->c6), in the reverse order
+static void hello_rx_reverse(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    hello_undo *u = &m->undo.rx.hello;
+    o_local orig = OLSR_LOCAL(m->originator);
+    olsr_mask heard = m->mt.h.neighbors & ~OLSR_MASK_BIT(OLSR_LOCAL(s->local_address));
+    olsr_mask added = heard & ~u->two_hop_mask;
+    two_hop_undo *t;
+    int j;
+    
+    if (bf->c9) {
+        if (bf->c10) {
+            s->num_mpr_sel--;
+            s->ansn--;
+        }
+        s->mprSelSet[s->num_mpr_sel] = u->mpr_sel;
+        s->mpr_sel_from[s->num_mpr_sel] = u->mpr_sel_from;
+    }
+    
+    *wheel_slot_at(s->wheel_two_hop, tw_now(lp) + NEIGHB_HOLD_TIME) = u->wheel[1];
+    
+    // The added tuples are the last ones in the set
+    for (j = olsr_popcount(added); j > 0; j--) {
+        s->num_two_hop--;
+        t = &u->two_hop[s->twoHopSet.twoHopNeighborAddr[s->num_two_hop]];
+        s->twoHopSet.neighborMainAddr[s->num_two_hop] = t->neighborMainAddr;
+        s->twoHopSet.twoHopNeighborAddr[s->num_two_hop] = t->twoHopNeighborAddr;
+        s->twoHopSet.expirationTime[s->num_two_hop] = t->expirationTime;
+        s->two_hop_from[s->num_two_hop] = t->from;
+    }
+    s->two_hop_mask[orig] = u->two_hop_mask;
+    
+    for (j = 0; j < s->num_two_hop; j++) {
+        if (s->twoHopSet.neighborMainAddr[j] == orig &&
+            (heard & OLSR_MASK_BIT(s->twoHopSet.twoHopNeighborAddr[j]))) {
+            s->twoHopSet.expirationTime[j] =
+                u->two_hop[s->twoHopSet.twoHopNeighborAddr[j]].expirationTime;
+        }
+    }
+    
+    *wheel_slot_at(s->wheel_neigh, tw_now(lp) + NEIGHB_HOLD_TIME) = u->wheel[0];
+    
+    if (bf->c5) {
+        s->num_neigh--;
+        s->neigh_mask &= ~OLSR_MASK_BIT(orig);
+        s->ansn--;
+        s->neighSet[s->num_neigh] = u->neigh;
+        s->neigh_from[s->num_neigh] = u->neigh_from;
+    }
+    else {
+        *FindSymNeighborTuple(s, orig) = u->neigh;
+    }
+}
+
+/// Link tuple i in at the old end of the duplicate expiry ring
+static void dup_link_oldest(node_state *s, uint8_t i)
+{
+    uint8_t oldest = s->dup_oldest;
+    uint8_t newest;
+    
+    if (oldest == OLSR_DUP_NONE) {
+        s->dupSet[i].prev = i;
+        s->dupSet[i].next = i;
+    }
+    else {
+        newest = s->dupSet[oldest].prev;
+        s->dupSet[i].prev = newest;
+        s->dupSet[i].next = oldest;
+        s->dupSet[newest].next = i;
+        s->dupSet[oldest].prev = i;
+    }
+    
+    s->dup_oldest = i;
+}
+
+/**
+ * Undo TC_RX.  The duplicate hash may come back in a different probe
+ * order, which FindDuplicateTuple() does not care about.
+ */
+static void tc_rx_reverse(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    tc_undo *u = &m->undo.rx.tc;
+    o_local orig = OLSR_LOCAL(m->originator);
+    dup_tuple *d;
+    uint8_t i;
+    unsigned k;
+    
+    if (bf->c13) {
+        *wheel_slot_at(s->wheel_top, tw_now(lp) + TOP_HOLD_TIME) = u->wheel;
+        s->topSet.destAddr[orig] = u->destAddr;
+        s->top_removed[orig] = u->top_removed;
+        s->topSet.sequenceNumber[orig] = u->sequenceNumber;
+        s->topSet.expirationTime[orig] = u->expirationTime;
+    }
+    
+    if (!bf->c11 && !bf->c12) return;
+    
+    d = FindDuplicateTuple(orig, m->seq_num, s);
+    i = d - s->dupSet;
+    
+    if (bf->c11) {
+        // Back between the tuples it was refreshed from
+        dup_unlink(s, i);
+        *d = u->dup;
+        s->dupSet[d->prev].next = i;
+        s->dupSet[d->next].prev = i;
+        s->dup_oldest = u->dup_oldest;
+        return;
+    }
+    
+    dup_unhash(s, i);
+    dup_unlink(s, i);
+    *d = u->dup;
+    s->dup_free = i;
+    s->num_dupes--;
+    
+    // dup_make_room() pushed what it removed onto the free list oldest
+    // first, so the oldest comes off it last
+    for (k = 0; k < u->dup_removed; k++) {
+        i = s->dup_free;
+        s->dup_free = s->dupSet[i].next;
+        dup_hash_insert(s, i);
+        dup_link_oldest(s, i);
+        s->num_dupes++;
+    }
+}
+
+/**
+ * Put back what the event carrying m changed in s, from the tw_bf bits
+ * and m->undo.  The MPR set and the routing table are functions of the
+ * other sets, so they are just marked stale.
+ */
+static void olsr_event_undo(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    switch (m->type) {
+        case HELLO_RX:
+            if (bf->c6) {
+                hello_rx_reverse(s, bf, m, lp);
+            }
+            break;
+            
+        case TC_RX:
+            tc_rx_reverse(s, bf, m, lp);
+            break;
+            
+        case TC_TX:
+            s->msg_seq--;
+            break;
+            
+        case SA_TX:
+        case SA_RX:
+            if (bf->c14) {
+                s->SA_per_node[m->originator % OLSR_MAX_NEIGHBORS]--;
+            }
+            // Lookup() may have rebuilt the table
+            s->routes_dirty = 1;
+            break;
+            
+        default:
+            break;
+    }
+    
+    expire_tuples_reverse(s, m);
+    
+    if (bf->c1 || bf->c7 || bf->c8) {
+        s->mpr_dirty = 1;
+    }
+    
+    if (bf->c7 || bf->c8 || bf->c13 || m->undo.expire.top) {
+        s->routes_dirty = 1;
+    }
+}
+#endif
+
+/**
+ * Reverse event handler.  Every tw_rand_unif() call is undone using the
+ * bits olsr_event() set:
+ * - c0: the message was passed along the chain (one RNG call)
+ * - c1: HELLO_TX rebuilt the MPR set
+ * - c2: SA_TX/SA_RX routed a packet (one RNG call)
+ * - c3: TC_RX decremented the TTL
+ * - c4: ForwardDefault() retransmitted the TC (one RNG call)
+ * - c5: HELLO_RX added a neighbor
+ * - c6: HELLO_RX was heard and processed
+ * - c7: HELLO_RX changed the 1-hop or 2-hop set
+ * - c8: expire_tuples() changed the 1-hop or 2-hop set
+ * - c9: HELLO_RX named us as MPR, c10: by a new selector
+ * - c11: TC_RX refreshed a duplicate tuple, c12: added one
+ * - c13: TC_RX updated the topology set
+ * - c14: SA_TX/SA_RX counted an SA packet
+ * - c15: HELLO_RX changed the sets while the MPR set was already stale
+ *
+ * Every change to node_state is put back from the delta log, along with
+ * the MPR set and the routing table, or with OLSR_REVERSE from the bits
+ * and the undo record (olsr_event_undo()).
+ */
+static void olsr_event_reverse_handler(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    g_olsr_stats.events[m->type]--;
+    count_delivery(m, OLSR_PAIR_NODE_NODE, -1);
+#if OLSR_REVERSE
+    olsr_event_undo(s, bf, m, lp);
+#else
+    olsr_delta_rollback(s, m);
+#endif
+    
+    switch (m->type) {
+        case HELLO_TX:
+            if (bf->c1) {
+                g_olsr_stats.mpr_computed--;
+            }
+            tw_rand_reverse_unif(lp->rng);
+            return;
+            
+        case TC_TX:
+            tw_rand_reverse_unif(lp->rng);
+            return;
+            
+        case HELLO_RX:
+            if (bf->c0) {
+                tw_rand_reverse_unif(lp->rng);
+            }
+            
+            if (bf->c6 && (!bf->c7 || bf->c15)) {
+                g_olsr_stats.mpr_avoided--;
+            }
+            return;
+            
+        case TC_RX:
+            if (bf->c3) {
+                m->ttl++;
+            }
+            
+            if (bf->c0) {
+                tw_rand_reverse_unif(lp->rng);
+            }
+            
+            if (bf->c4) {
+                tw_rand_reverse_unif(lp->rng);
+            }
+            return;
+            
+        case SA_TX:
+        case SA_RX:
+            if (bf->c0) {
+                tw_rand_reverse_unif(lp->rng);
+            }
+            
+            if (bf->c2) {
+                tw_rand_reverse_unif(lp->rng);
+            }
+            return;
+            
+        case SA_MASTER_TX:
+            tw_rand_reverse_unif(lp->rng);
+            tw_rand_reverse_unif(lp->rng);
+            return;
+            
+        case RWALK_CHANGE:
+            swap_position(s, m);
+            region_grid_place(s->local_address, s->lng, s->lat);
+            
+            tw_rand_reverse_unif(lp->rng);
+            tw_rand_reverse_unif(lp->rng);
+            tw_rand_reverse_unif(lp->rng);
+            return;
+            
+        default:
+            return;
+    }
+}
+
+/** Reverse handler for OLSR nodes: olsr_event_reverse_handler(), traced */
 void olsr_event_reverse(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
 {
-#if ENABLE_OPTIMISTIC
-    if( g_tw_synchronization_protocol == OPTIMISTIC )
-      {
-	memcpy( s, &(m->state_copy), sizeof(node_state));
-      }
-    g_olsr_event_stats[m->type]--;
-#endif 
+    olsr_event_reverse_handler(s, bf, m, lp);
+    OLSR_TRACE(lp, m, OLSR_TRACE_REVERSE);
+}
+
+void sa_master_event_reverse(node_state *s, tw_bf *bf, olsr_msg_data *m, tw_lp *lp)
+{
+    g_olsr_stats.events[m->type]--;
+    count_delivery(m, sa_master_pair(m), -1);
+    
+    if (bf->c0) {
+        tw_rand_reverse_unif(lp->rng);
+    }
+    
+    OLSR_TRACE(lp, m, OLSR_TRACE_REVERSE);
 }
 
 void olsr_final(node_state *s, tw_lp *lp)
 {
     int i;
+    olsr_mask top;
     
     if( OLSR_NO_FINAL_OUTPUT )
       return;
@@ -1842,8 +2820,10 @@ void olsr_final(node_state *s, tw_lp *lp)
     printf("node %lu contains %d neighbors\n", s->local_address, s->num_neigh);
     printf("x: %f   \ty: %f\n", s->lng, s->lat);
     for (i = 0; i < s->num_neigh; i++) {
-        printf("   neighbor[%d] is %lu\n", i, s->neighSet[i].neighborMainAddr);
-        printf("   Dy(%lu) is %d\n", s->neighSet[i].neighborMainAddr,
+        printf("   neighbor[%d] is %lu\n", i,
+               OLSR_GLOBAL(s->local_address, s->neighSet[i].neighborMainAddr));
+        printf("   Dy(%lu) is %d\n",
+               OLSR_GLOBAL(s->local_address, s->neighSet[i].neighborMainAddr),
                Dy(s, s->neighSet[i].neighborMainAddr));
     }
     
@@ -1851,30 +2831,46 @@ void olsr_final(node_state *s, tw_lp *lp)
            s->num_two_hop);
     for (i = 0; i < s->num_two_hop; i++) {
         printf("   two-hop neighbor[%d] is %lu : %lu\n", i, 
-               s->twoHopSet[i].neighborMainAddr,
-               s->twoHopSet[i].twoHopNeighborAddr);
+               OLSR_GLOBAL(s->local_address, s->twoHopSet.neighborMainAddr[i]),
+               OLSR_GLOBAL(s->local_address, s->twoHopSet.twoHopNeighborAddr[i]));
+    }
+    
+    if (s->mpr_dirty) {
+        MprComputation(s, &g_mpr_scratch);
+        s->mpr_dirty = 0;
     }
     
     printf("node %lu has %d MPRs\n", s->local_address, 
            s->num_mpr);
     for (i = 0; i < s->num_mpr; i++) {
         printf("   MPR[%d] is %lu\n", i, 
-               s->mprSet[i]);
+               OLSR_GLOBAL(s->local_address, s->mprSet[i]));
     }
     
     printf("node %lu had %d MPR selectors\n", s->local_address, s->num_mpr_sel);
     
+    if (s->routes_dirty) {
+        RoutingTableComputation(s);
+        s->routes_dirty = 0;
+    }
+    
     printf("node %lu routing table\n", s->local_address);
-    for (i = 0; i < s->num_routes; i++) {
+    for (i = 0; i < OLSR_MAX_NEIGHBORS; i++) {
+        if (!(s->route_valid & OLSR_MASK_BIT(i))) continue;
         printf("   route[%d]: dest: %lu \t next %lu \t distance %d\n",
-               i, s->route_table[i].destAddr,
-               s->route_table[i].nextAddr, s->route_table[i].distance);
+               i, OLSR_GLOBAL(s->local_address, s->route_table[i].destAddr),
+               OLSR_GLOBAL(s->local_address, s->route_table[i].nextAddr),
+               s->route_table[i].distance);
     }
     
     printf("node %lu top tuples\n", s->local_address);
-    for (i = 0; i < s->num_top_set; i++) {
-        printf("   top_tuple[%d] dest: %lu   last:  %lu   seq:   %d\n",
-               i, s->topSet[i].destAddr, s->topSet[i].lastAddr, s->topSet[i].sequenceNumber);
+    for (i = 0; i < OLSR_MAX_NEIGHBORS; i++) {
+        for (top = s->topSet.destAddr[i]; top; top &= top - 1) {
+            printf("   top_tuple dest: %lu   last:  %lu   seq:   %d\n",
+                   OLSR_GLOBAL(s->local_address, olsr_ctz(top)),
+                   OLSR_GLOBAL(s->local_address, i),
+                   s->topSet.sequenceNumber[i]);
+        }
     }
     
     /*
@@ -1921,6 +2917,11 @@ void olsr_custom_mapping(void)
 	if(!nlp_per_kp)
 		tw_error(TW_LOC, "Not enough KPs defined: %d", g_tw_nkp);
     
+    // Whole regions per KP.  A sender reads the positions of the other
+    // LPs in its region, which is only rollback-safe if they all roll
+    // back with it, i.e. share its KP.
+    nlp_per_kp = (nlp_per_kp + OLSR_MAX_NEIGHBORS - 1) / OLSR_MAX_NEIGHBORS * OLSR_MAX_NEIGHBORS;
+    
 	g_tw_lp_offset = g_tw_mynode * SA_range_start;
     foo = g_tw_lp_offset;
     
@@ -2032,7 +3033,7 @@ tw_lptype olsr_lps[] = {
     {
         (init_f) sa_master_init,
         (event_f) sa_master_event,
-        (revent_f) NULL,
+        (revent_f) sa_master_event_reverse,
         (final_f) null,
         (map_f) olsr_map,
         sizeof(node_state)
@@ -1,20 +1,228 @@
 #include "olsr.h"
+#include <unistd.h>
+#include <sys/resource.h>
 
 extern unsigned int nlp_per_pe;
-extern char g_olsr_mobility;
+extern char g_olsr_mobility[OLSR_OPT_LEN];
+extern unsigned int g_olsr_fanout;
 extern unsigned int SA_range_start;
-extern unsigned long long g_olsr_event_stats[OLSR_END_EVENT];
-extern unsigned long long g_olsr_root_event_stats[OLSR_END_EVENT];
 extern tw_lptype olsr_lps[];
 
+/** Nodes per region asked for on the command line */
+unsigned int g_olsr_region = OLSR_MAX_NEIGHBORS;
+/** File to append a CSV record of this run to, see olsr-scaling.sh */
+char g_olsr_bench_file[256] = "";
+/** Events each rank keeps in its olsr-trace.<rank> ring, 0 for no trace */
+unsigned int g_olsr_trace_records = 0;
+
+/**
+ * union message_type as it was when a TC had room for OLSR_MAX_NEIGHBORS squared
+ * addresses and latlng_cluster was still in it.  Only used to print what
+ * events would cost that way.
+ */
+union message_type_before {
+    union message_type now;
+    struct {
+        uint16_t ansn;
+        o_local neighborAddresses[OLSR_MAX_NEIGHBORS * OLSR_MAX_NEIGHBORS];
+        unsigned num_neighbors;
+    } t;
+    latlng_cluster llc;
+};
+
 const tw_optdef olsr_opts[] = {
     TWOPT_GROUP("OLSR Model"),
     TWOPT_UINT("lp_per_pe", nlp_per_pe, "number of LPs per processor"),
     TWOPT_STIME("lookahead", g_tw_lookahead, "lookahead for the simulation"),
     TWOPT_CHAR("rwalk", g_olsr_mobility, "random walk [Y/N]"),
+    TWOPT_UINT("fanout", g_olsr_fanout, "deliver broadcasts directly to in-range receivers instead of along the region chain [0/1]"),
+    TWOPT_UINT("region", g_olsr_region, "nodes per region (8, 16, 32 or 64)"),
+    TWOPT_CHAR("bench", g_olsr_bench_file, "append a CSV record of this run to this file"),
+    TWOPT_UINT("trace", g_olsr_trace_records, "keep a binary trace of the last N events per rank in olsr-trace.<rank> (0 = off)"),
     TWOPT_END(),
 };
 
+#if OLSR_TIMING
+static const char *cost_names[OLSR_COSTS] = {
+    "handler",
+    "MPR",
+    "routes",
+    "dups",
+};
+
+/**
+ * Print where the time went, per event type.  cost_ns is summed over
+ * every rank; MPR, route and duplicate time is part of the handler time.
+ */
+static void olsr_print_costs(unsigned long long cost_ns[OLSR_COSTS][OLSR_END_EVENT],
+                             unsigned long long *events)
+{
+    int i, c;
+    
+    printf("OLSR event cost: ns per committed event, then total ms by part (including rolled back work)\n");
+    printf("%-14s %12s", "type", "ns/event");
+    for (c = 0; c < OLSR_COSTS; c++) {
+        printf(" %12s", cost_names[c]);
+    }
+    printf("\n");
+    
+    for (i = 0; i < OLSR_END_EVENT; i++) {
+        printf("%-14s %12.0f", event_names[i],
+               events[i] ? (double)cost_ns[OLSR_COST_HANDLER][i] / events[i] : 0.0);
+        for (c = 0; c < OLSR_COSTS; c++) {
+            printf(" %12.3f", cost_ns[c][i] / 1e6);
+        }
+        printf("\n");
+    }
+}
+#endif
+
+static const char *pair_names[OLSR_PAIRS] = {
+    "node->node",
+    "node->master",
+    "master->master",
+};
+
+static void print_traffic_line(const char *name, unsigned long long all,
+                               unsigned long long remote)
+{
+    printf("%-16s %14llu %14llu %8.2f%%\n", name, all - remote, remote,
+           all ? 100.0 * remote / all : 0.0);
+}
+
+/**
+ * Print how many committed events were delivered within their rank and
+ * how many came from another one: per event type, per kind of LP pair
+ * and, for SA_MASTER_RX, per level of the master hierarchy.  t holds the
+ * totals over every rank.
+ */
+static void olsr_print_traffic(olsr_stats *t)
+{
+    int i;
+    char level[16];
+    
+    printf("OLSR traffic:    %14s %14s %9s\n", "local", "remote", "remote");
+    for (i = 0; i < OLSR_END_EVENT; i++) {
+        print_traffic_line(event_names[i], t->events[i], t->remote[i]);
+    }
+    for (i = 0; i < OLSR_PAIRS; i++) {
+        print_traffic_line(pair_names[i], t->pair_events[i], t->pair_remote[i]);
+    }
+    for (i = 0; i < OLSR_MAX_LEVELS; i++) {
+        if (t->level_events[i] == 0) continue;
+        snprintf(level, sizeof(level), "SA level %d", i);
+        print_traffic_line(level, t->level_events[i], t->level_remote[i]);
+    }
+}
+
+/**
+ * Append one CSV record describing this run to g_olsr_bench_file, with a
+ * header line first if the file is new.  Counts are summed over every
+ * rank; the memory figures are the largest of any rank.
+ */
+static void olsr_bench_record(double wall,
+                              unsigned long long *events,
+                              unsigned long long *remote,
+                              unsigned long long peak_events,
+                              long long max_rss_kb)
+{
+    int i;
+    FILE *f;
+    unsigned long long committed = 0;
+    unsigned long long crossed = 0;
+    
+    for (i = 0; i < OLSR_END_EVENT; i++) {
+        committed += events[i];
+        crossed += remote[i];
+    }
+    
+    f = fopen(g_olsr_bench_file, "a");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot append to %s\n", g_olsr_bench_file);
+        return;
+    }
+    
+    if (ftell(f) == 0) {
+        fprintf(f, "ranks,lp_per_pe,region,lookahead,rwalk,fanout,synch,"
+                "wall_s,committed,event_rate,remote_fraction,"
+                "peak_events,peak_event_bytes,max_rss_kb");
+        for (i = 0; i < OLSR_END_EVENT; i++) {
+            fprintf(f, ",%s", event_names[i]);
+        }
+        fprintf(f, "\n");
+    }
+    
+    fprintf(f, "%u,%u,%d,%g,%c,%u,%d,%.6f,%llu,%.1f,%.6f,%llu,%llu,%lld",
+            tw_nnodes(), SA_range_start, OLSR_MAX_NEIGHBORS, g_tw_lookahead,
+            g_olsr_mobility[0], g_olsr_fanout, g_tw_synchronization_protocol,
+            wall, committed, wall > 0 ? committed / wall : 0.0,
+            committed ? (double)crossed / committed : 0.0,
+            peak_events,
+            peak_events * (sizeof(tw_event) + sizeof(olsr_msg_data)),
+            max_rss_kb);
+    for (i = 0; i < OLSR_END_EVENT; i++) {
+        fprintf(f, ",%llu", events[i]);
+    }
+    fprintf(f, "\n");
+    
+    fclose(f);
+}
+
+/**
+ * The region size is fixed when the model is compiled.  If --region asks
+ * for a different one, replace this process with the olsr-j-N binary built
+ * for it, which sits next to this one.  This has to happen before
+ * tw_init() brings up MPI.
+ */
+static void olsr_region_exec(int argc, char *argv[])
+{
+    int i;
+    unsigned int n = OLSR_MAX_NEIGHBORS;
+    char path[PATH_MAX];
+    const char *slash;
+    
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--region=", 9)) {
+            n = atoi(argv[i] + 9);
+        }
+    }
+    
+    if (n == OLSR_MAX_NEIGHBORS) return;
+    
+    if (n != 8 && n != 16 && n != 32 && n != 64) {
+        fprintf(stderr, "--region=%u: region size must be 8, 16, 32 or 64\n", n);
+        exit(1);
+    }
+    
+    slash = strrchr(argv[0], '/');
+    snprintf(path, sizeof(path), "%.*solsr-j-%u",
+             slash ? (int)(slash - argv[0] + 1) : 0, argv[0], n);
+    
+    execv(path, argv);
+    
+    fprintf(stderr, "--region=%u: cannot run %s\n", n, path);
+    exit(1);
+}
+
+/**
+ * TWOPT_CHAR options strcpy() their whole argument into the model's
+ * buffer.  Refuse to start if --name's argument does not fit in len bytes.
+ * This has to happen before tw_init() parses the options.
+ */
+static void olsr_check_opt_len(int argc, char *argv[], const char *name, size_t len)
+{
+    int i;
+    size_t n = strlen(name);
+    
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--", 2) && !strncmp(argv[i] + 2, name, n) &&
+            argv[i][2 + n] == '=' && strlen(argv[i] + 3 + n) >= len) {
+            fprintf(stderr, "--%s: argument longer than %zu characters\n", name, len - 1);
+            exit(1);
+        }
+    }
+}
+
 // Done mainly so doxygen will catch and differentiate this main
 // from other mains while allowing smooth compilation.
 #define olsr_main main
@@ -22,18 +230,31 @@ const tw_optdef olsr_opts[] = {
 int olsr_main(int argc, char *argv[])
 {
     int i;
-    char log[32];
+    double wall;
+    double root_wall;
+    unsigned long long root_event_stats[OLSR_END_EVENT];
+    unsigned long long root_remote[OLSR_END_EVENT];
+    olsr_stats root;
+    struct rusage ru;
+    long long rss;
+    long long root_rss;
+    unsigned long long root_peak;
+#if OLSR_TIMING
+    unsigned long long root_cost_ns[OLSR_COSTS][OLSR_END_EVENT];
+#endif
+    unsigned long long mpr[2];
+    unsigned long long root_mpr[2];
+    unsigned long long delta[2];
+    unsigned long long root_delta[2];
+    
+    olsr_region_exec(argc, argv);
+    olsr_check_opt_len(argc, argv, "rwalk", sizeof(g_olsr_mobility));
+    olsr_check_opt_len(argc, argv, "bench", sizeof(g_olsr_bench_file));
     
     tw_opt_add(olsr_opts);
     tw_init(&argc, &argv);
     
-#if DEBUG
-    sprintf( log, "olsr-log.%d", g_tw_mynode );
-    
-    olsr_event_log = fopen( log, "w+");
-    if( olsr_event_log == NULL )
-        tw_error( TW_LOC, "Failed to Open OLSR Event Log file \n");
-#endif
+    olsr_trace_open(g_olsr_trace_records);
     
     g_tw_mapping = CUSTOM;
     g_tw_custom_initial_mapping = &olsr_custom_mapping;
@@ -50,8 +271,17 @@ int olsr_main(int argc, char *argv[])
     g_tw_events_per_pe =  OLSR_MAX_NEIGHBORS / 2 * nlp_per_pe  + 65536;
     tw_define_lps(nlp_per_pe, sizeof(olsr_msg_data), 0);
     
-    for(i = 0; i < OLSR_END_EVENT; i++)
-        g_olsr_event_stats[i] = 0;
+    if (tw_ismaster()) {
+        size_t before = sizeof(olsr_msg_data) - sizeof(union message_type)
+                        + sizeof(union message_type_before);
+        
+        printf("OLSR event memory per PE: %lu events x (%zu + %zu byte message) = %.1f MiB\n",
+               (unsigned long)g_tw_events_per_pe, sizeof(tw_event), sizeof(olsr_msg_data),
+               (double)g_tw_events_per_pe * (sizeof(tw_event) + sizeof(olsr_msg_data)) / (1024 * 1024));
+        printf("OLSR event memory per PE with region-squared TCs: %zu byte message = %.1f MiB\n",
+               before,
+               (double)g_tw_events_per_pe * (sizeof(tw_event) + before) / (1024 * 1024));
+    }
     
     for (i = 0; i < SA_range_start; i++) {
         tw_lp_settype(i, &olsr_lps[0]);
@@ -65,24 +295,81 @@ int olsr_main(int argc, char *argv[])
     printf("g_tw_nlp is %lu\n", g_tw_nlp);
 #endif
     
+    wall = MPI_Wtime();
     tw_run();
+    wall = MPI_Wtime() - wall;
+    
+    olsr_trace_close();
+    
+    mpr[0] = g_olsr_stats.mpr_computed;
+    mpr[1] = g_olsr_stats.mpr_avoided;
+    
+    getrusage(RUSAGE_SELF, &ru);
+    rss = ru.ru_maxrss;
     
     if( g_tw_synchronization_protocol != 1 )
     {
-        MPI_Reduce( g_olsr_event_stats, g_olsr_root_event_stats, OLSR_END_EVENT, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( g_olsr_stats.events, root_event_stats, OLSR_END_EVENT, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( g_olsr_stats.remote, root_remote, OLSR_END_EVENT, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( g_olsr_stats.pair_events, root.pair_events, OLSR_PAIRS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( g_olsr_stats.pair_remote, root.pair_remote, OLSR_PAIRS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( g_olsr_stats.level_events, root.level_events, OLSR_MAX_LEVELS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( g_olsr_stats.level_remote, root.level_remote, OLSR_MAX_LEVELS, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( mpr, root_mpr, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce( &wall, &root_wall, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce( &rss, &root_rss, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce( &g_olsr_stats.events_peak, &root_peak, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+#if OLSR_TIMING
+        MPI_Reduce( g_olsr_stats.cost_ns, root_cost_ns, OLSR_COSTS * OLSR_END_EVENT, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
     }
     else {
         for (i = 0; i < OLSR_END_EVENT; i++) {
-            g_olsr_root_event_stats[i] = g_olsr_event_stats[i];
+            root_event_stats[i] = g_olsr_stats.events[i];
+            root_remote[i] = g_olsr_stats.remote[i];
         }
+        root_mpr[0] = mpr[0];
+        root_mpr[1] = mpr[1];
+        root_wall = wall;
+        root_rss = rss;
+        root_peak = g_olsr_stats.events_peak;
+        root = g_olsr_stats;
+#if OLSR_TIMING
+        memcpy(root_cost_ns, g_olsr_stats.cost_ns, sizeof(root_cost_ns));
+#endif
     }
     
     if (tw_ismaster()) {
         for( i = 0; i < OLSR_END_EVENT; i++ )
-            printf("OLSR Type %s Event Count = %llu \n", event_names[i], g_olsr_root_event_stats[i]);
+            printf("OLSR Type %s Event Count = %llu \n", event_names[i], root_event_stats[i]);
+        printf("OLSR MPR Computations = %llu, Avoided (HELLO_RX changed nothing or found the set already stale) = %llu \n", root_mpr[0], root_mpr[1]);
+        memcpy(root.events, root_event_stats, sizeof(root.events));
+        memcpy(root.remote, root_remote, sizeof(root.remote));
+        olsr_print_traffic(&root);
+#if OLSR_TIMING
+        olsr_print_costs(root_cost_ns, root_event_stats);
+#endif
+        printf("OLSR wall time = %.3f s\n", root_wall);
+        printf("OLSR peak events in use = %llu of %lu per PE\n",
+               root_peak, (unsigned long)g_tw_events_per_pe);
+        if (g_olsr_bench_file[0]) {
+            olsr_bench_record(root_wall, root_event_stats, root_remote, root_peak, root_rss);
+        }
         printf("Complete.\n");
     }
     
+    if (g_tw_synchronization_protocol == OPTIMISTIC) {
+        delta[0] = g_olsr_stats.delta_bytes;
+        delta[1] = g_olsr_stats.delta_segments;
+        MPI_Reduce(delta, root_delta, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        
+        if (tw_ismaster() && root_delta[1] > 0) {
+            printf("OLSR delta log: %llu bytes saved by %llu events, %.1f bytes/event (node_state is %lu bytes)\n",
+                   root_delta[0], root_delta[1],
+                   (double)root_delta[0] / root_delta[1], sizeof(node_state));
+        }
+    }
+    
     tw_end();
     
     return 0;
@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# Strong and weak scaling runs of olsr-j on one machine.
+#
+# Runs every combination of rank count, lookahead and mobility below,
+# twice: once with the total number of nodes fixed (strong scaling) and
+# once with the nodes per rank fixed (weak scaling).  Each run appends one
+# CSV record (see olsr_bench_record() in olsr-main.c) to
+#
+#   $OUT-<version>-strong.csv
+#   $OUT-<version>-weak.csv
+#
+# where <version> is what git describe says about this tree, so runs of
+# different versions land side by side.  Everything can be overridden from
+# the environment, e.g.
+#
+#   RANKS="1 2 4 8" END=200 ./olsr-scaling.sh
+#
+# Anything after the script's own arguments is passed on to olsr-j.
+#
+# Each rank has to get a whole number of regions, so the script refuses
+# to start if STRONG_NODES / np or WEAK_NODES is not a multiple of the
+# region size (16, or whatever --region= asks for).
+
+OLSR=${OLSR:-./olsr-j}
+MPIRUN=${MPIRUN:-mpirun}
+RANKS=${RANKS:-"1 2 4"}
+LOOKAHEADS=${LOOKAHEADS:-"0.01 0.1"}
+RWALKS=${RWALKS:-"N Y"}
+# Strong scaling: nodes in the whole simulation
+STRONG_NODES=${STRONG_NODES:-1024}
+# Weak scaling: nodes per rank
+WEAK_NODES=${WEAK_NODES:-256}
+SYNCH=${SYNCH:-3}
+END=${END:-100}
+OUT=${OUT:-olsr-scaling}
+
+region=16
+for arg in "$@"; do
+    case $arg in
+        --region=*) region=${arg#--region=} ;;
+    esac
+done
+
+for np in $RANKS; do
+    if [ $((STRONG_NODES % (np * region))) -ne 0 ]; then
+        echo "$0: STRONG_NODES=$STRONG_NODES does not split into whole regions of $region nodes over $np rank(s)" >&2
+        exit 1
+    fi
+done
+if [ $((WEAK_NODES % region)) -ne 0 ]; then
+    echo "$0: WEAK_NODES=$WEAK_NODES is not a whole number of regions of $region nodes" >&2
+    exit 1
+fi
+
+here=$(dirname "$0")
+version=$(git -C "$here" describe --always --dirty 2>/dev/null || echo unknown)
+
+run()
+{
+    # run <csv> <ranks> <lp_per_pe> <lookahead> <rwalk> [olsr-j args...]
+    csv=$1 np=$2 lps=$3 la=$4 rw=$5
+    shift 5
+    echo "== $csv: $np rank(s), $lps LPs/rank, lookahead $la, rwalk $rw"
+    $MPIRUN -np "$np" "$OLSR" --synch="$SYNCH" --end="$END" \
+        --lp_per_pe="$lps" --lookahead="$la" --rwalk="$rw" \
+        --bench="$csv" "$@" > /dev/null || echo "   FAILED"
+}
+
+for np in $RANKS; do
+    for la in $LOOKAHEADS; do
+        for rw in $RWALKS; do
+            run "$OUT-$version-strong.csv" "$np" $((STRONG_NODES / np)) "$la" "$rw" "$@"
+            run "$OUT-$version-weak.csv" "$np" "$WEAK_NODES" "$la" "$rw" "$@"
+        done
+    done
+done
@@ -3,21 +3,22 @@
 #define CATCH_CONFIG_MAIN  // This tell CATCH to provide a main()
                            // only do this in one cpp file
 #include "catch.hpp"
-
-// Make sure all the types, variables, functions, etc. that you need
-// are available.
-
-typedef uintptr_t o_addr;
-int world_size;
-unsigned int SA_range_start;
+#include <random>
 
 // Catch is a C++ testing framework.  As such, you need to tell it to look
 // for things the way they are specified in C, i.e. function names should
 // not be mangled.
 extern "C" {
+#include "olsr.h"
     o_addr sa_master_for_level(o_addr lpid);
 }
 
+// Make sure all the types, variables, functions, etc. that you need
+// are available.
+
+int world_size;
+unsigned int SA_range_start;
+
 // A really simple test case
 TEST_CASE("foo", "A simple test case")
 {
@@ -55,6 +56,169 @@ TEST_CASE("sa_master_for_level/simple", "Testing SMFL function")
     REQUIRE ( 16 == sa_master_for_level(16) );
 }
 
+// Nodes within RANGE (60) of the sender are heard whichever grid cell
+// they happen to be filed under; moving a node updates its cell.
+TEST_CASE("region_grid/in_range", "Testing the region grid")
+{
+    SA_range_start = 16;
+    
+    region_grid_place(0, 10.0, 10.0);
+    region_grid_place(1, 50.0, 10.0);   // 40 away, same cell
+    region_grid_place(2, 90.0, 90.0);   // 113 away
+    region_grid_place(3, 10.0, 69.0);   // 59 away, neighboring cell
+    
+    REQUIRE ( ((1 << 1) | (1 << 3)) == region_grid_in_range(0, 10.0, 10.0) );
+    
+    region_grid_place(1, 95.0, 10.0);   // 85 away now
+    
+    REQUIRE ( (1 << 3) == region_grid_in_range(0, 10.0, 10.0) );
+    REQUIRE ( 0 == region_grid_in_range(2, 90.0, 90.0) );
+}
+
+// Fan-out delivers a broadcast to exactly the nodes region_grid_in_range()
+// names, where chain delivery hands it to every node and lets each one
+// drop it in out_of_radio_range().  The two only differ in event counts if
+// those agree, so check the grid against every receiver in turn.  Integer
+// coordinates make nodes exactly RANGE apart (e.g. 36, 48) turn up too.
+TEST_CASE("region_grid/brute_force", "Grid agrees with out_of_radio_range")
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> coord(0, 100);   // GRID_MAX
+    static node_state rx;
+    olsr_msg_data m;
+    double lng[OLSR_MAX_NEIGHBORS];
+    double lat[OLSR_MAX_NEIGHBORS];
+    int trial, i, j;
+    
+    SA_range_start = OLSR_MAX_NEIGHBORS;
+    
+    for (trial = 0; trial < 1000; trial++) {
+        for (i = 0; i < OLSR_MAX_NEIGHBORS; i++) {
+            lng[i] = coord(rng);
+            lat[i] = coord(rng);
+            region_grid_place(i, lng[i], lat[i]);
+        }
+        
+        for (i = 0; i < OLSR_MAX_NEIGHBORS; i++) {
+            olsr_mask expected = 0;
+            
+            memset(&m, 0, sizeof(m));
+            m.originator = i;
+            m.sender = i;
+            m.lng = lng[i];
+            m.lat = lat[i];
+            
+            for (j = 0; j < OLSR_MAX_NEIGHBORS; j++) {
+                if (j == i) continue;
+                rx.local_address = j;
+                rx.lng = lng[j];
+                rx.lat = lat[j];
+                if (!out_of_radio_range(&rx, &m)) {
+                    expected |= OLSR_MASK_BIT(j);
+                }
+            }
+            
+            REQUIRE ( expected == region_grid_in_range(i, lng[i], lat[i]) );
+        }
+    }
+}
+
+// Give s the neighbor n, and the 2-hop neighbor x through it if x isn't n
+static void add_two_hop(node_state *s, o_local n, o_local x)
+{
+    if (!(s->neigh_mask & OLSR_MASK_BIT(n))) {
+        s->neighSet[s->num_neigh++].neighborMainAddr = n;
+        s->neigh_mask |= OLSR_MASK_BIT(n);
+    }
+    
+    if (x == n) return;
+    
+    s->twoHopSet.neighborMainAddr[s->num_two_hop] = n;
+    s->twoHopSet.twoHopNeighborAddr[s->num_two_hop] = x;
+    s->num_two_hop++;
+    s->two_hop_mask[n] |= OLSR_MASK_BIT(x);
+}
+
+// Step 3 elects 5 (only one to reach 2) and 1 (only one to reach 7), and
+// 1 covers 6 as well.  Taking 2 out of N2 moves (1,6) into its slot; if
+// that slot is skipped rather than looked at again, (1,6) and (7,6) stay
+// in N2 and step 4 elects 7 for a 2-hop neighbor 1 already covers.
+TEST_CASE("mpr/greedy_covered", "Covered 2-hop neighbors all leave N2")
+{
+    static node_state s;
+    static olsr_mpr_greedy_scratch w;
+    
+    olsr_state_clear(&s);
+    s.local_address = 0;
+    add_two_hop(&s, 7, 7);
+    add_two_hop(&s, 1, 1);
+    add_two_hop(&s, 5, 2);
+    add_two_hop(&s, 1, 7);
+    add_two_hop(&s, 7, 6);
+    add_two_hop(&s, 1, 6);
+    
+    MprComputationGreedy(&s, &w);
+    
+    REQUIRE ( 2 == s.num_mpr );
+    REQUIRE ( 5 == s.mprSet[0] );
+    REQUIRE ( 1 == s.mprSet[1] );
+}
+
+// MprComputation() works on masks rather than walking N2, and has to elect
+// the same MPRs in the same order as the greedy algorithm.  Build random
+// regions of every density, with the 2-hop tuples in random order since
+// step 3 goes by that order.
+TEST_CASE("mpr/mask_matches_greedy", "Mask kernel agrees with the greedy algorithm")
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> addr(1, OLSR_MAX_NEIGHBORS - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    static node_state s;
+    static olsr_mpr_greedy_scratch greedy;
+    static olsr_mpr_scratch scratch;
+    o_local expected[OLSR_MAX_NEIGHBORS];
+    unsigned num_expected;
+    olsr_mask expected_mask;
+    int trial, i, j, density, num_neigh;
+    
+    for (trial = 0; trial < 20000; trial++) {
+        olsr_state_clear(&s);
+        s.local_address = 0;
+        num_neigh = addr(rng);
+        density = percent(rng);
+        
+        while (s.num_neigh < num_neigh) {
+            o_local n = addr(rng);
+            add_two_hop(&s, n, n);
+        }
+        
+        for (i = 0; i < s.num_neigh; i++) {
+            for (j = 1; j < OLSR_MAX_NEIGHBORS; j++) {
+                if (j != s.neighSet[i].neighborMainAddr && percent(rng) < density) {
+                    add_two_hop(&s, s.neighSet[i].neighborMainAddr, j);
+                }
+            }
+        }
+        
+        for (i = s.num_two_hop - 1; i > 0; i--) {
+            j = std::uniform_int_distribution<int>(0, i)(rng);
+            std::swap(s.twoHopSet.neighborMainAddr[i], s.twoHopSet.neighborMainAddr[j]);
+            std::swap(s.twoHopSet.twoHopNeighborAddr[i], s.twoHopSet.twoHopNeighborAddr[j]);
+        }
+        
+        MprComputationGreedy(&s, &greedy);
+        num_expected = s.num_mpr;
+        expected_mask = s.mpr_mask;
+        memcpy(expected, s.mprSet, sizeof(expected));
+        
+        MprComputation(&s, &scratch);
+        
+        REQUIRE ( num_expected == s.num_mpr );
+        REQUIRE ( expected_mask == s.mpr_mask );
+        REQUIRE ( 0 == memcmp(expected, s.mprSet, num_expected * sizeof(o_local)) );
+    }
+}
+
 TEST_CASE("master_hierarchy/simple", "Testing the MA function")
 {
     
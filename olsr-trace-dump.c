@@ -0,0 +1,109 @@
+#include "olsr-trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @file
+ * @brief Print olsr-trace.<rank> files as text
+ *
+ *   olsr-trace-dump olsr-trace.0 [olsr-trace.1 ...]
+ *
+ * One line per record, oldest first, prefixed with the rank and the
+ * record's number in the run so lines from several ranks can be sorted
+ * together.
+ */
+
+/// Keep in step with olsr_ev_type in olsr.h
+static const char *type_names[] = {
+    "HELLO_RX",
+    "HELLO_TX",
+    "TC_RX",
+    "TC_TX",
+    "SA_RX",
+    "SA_TX",
+    "SA_MASTER_TX",
+    "SA_MASTER_RX",
+    "RWALK_CHANGE",
+};
+
+static const char *kind_names[OLSR_TRACE_KINDS] = {
+    "init",
+    "fwd",
+    "rev",
+};
+
+#define NTYPES (sizeof(type_names) / sizeof(type_names[0]))
+
+static const char * type_name(unsigned type)
+{
+    if (type == OLSR_TRACE_NO_TYPE) return "-";
+    return type < NTYPES ? type_names[type] : "?";
+}
+
+static int dump(const char *name)
+{
+    FILE *f;
+    olsr_trace_header h;
+    olsr_trace_rec r;
+    uint64_t first, i;
+
+    f = fopen(name, "rb");
+    if (f == NULL) {
+        perror(name);
+        return 1;
+    }
+
+    if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != OLSR_TRACE_MAGIC) {
+        fprintf(stderr, "%s: not an OLSR trace\n", name);
+        fclose(f);
+        return 1;
+    }
+    if (h.version != OLSR_TRACE_VERSION || h.record_size != sizeof(r)) {
+        fprintf(stderr, "%s: trace version %u with %u byte records, expected %d and %zu\n",
+                name, h.version, h.record_size, OLSR_TRACE_VERSION, sizeof(r));
+        fclose(f);
+        return 1;
+    }
+
+    first = h.head > h.capacity ? h.head - h.capacity : 0;
+    printf("# %s: rank %d, %llu events traced, last %llu kept\n", name, h.rank,
+           (unsigned long long)h.head, (unsigned long long)(h.head - first));
+    printf("# rank record kind type gid ts originator sender target seq src_rank rng\n");
+
+    for (i = first; i < h.head; i++) {
+        if (fseek(f, sizeof(h) + (i % h.capacity) * sizeof(r), SEEK_SET) != 0 ||
+            fread(&r, sizeof(r), 1, f) != 1) {
+            fprintf(stderr, "%s: truncated at record %llu\n", name, (unsigned long long)i);
+            fclose(f);
+            return 1;
+        }
+
+        printf("%d %llu %s %s %llu %.9f %llu %llu %llu %u %d %u %u %u %u\n",
+               h.rank, (unsigned long long)i,
+               r.kind < OLSR_TRACE_KINDS ? kind_names[r.kind] : "?",
+               type_name(r.type), (unsigned long long)r.gid, r.ts,
+               (unsigned long long)r.originator, (unsigned long long)r.sender,
+               (unsigned long long)r.target, r.seq_num, r.src_rank,
+               r.rng[0], r.rng[1], r.rng[2], r.rng[3]);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    int ret = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s olsr-trace.<rank> ...\n", argv[0]);
+        return 2;
+    }
+
+    for (i = 1; i < argc; i++) {
+        ret |= dump(argv[i]);
+    }
+
+    return ret;
+}
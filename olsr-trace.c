@@ -0,0 +1,101 @@
+#include "olsr.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * @file
+ * @brief Binary event trace
+ *
+ * Each rank maps olsr-trace.<rank> and writes one fixed-size record per
+ * event into it as a ring (layout in olsr-trace.h).  A record is a
+ * handful of stores into the page cache, so the trace can stay on for
+ * full-size runs; the kernel writes the pages back on its own, so the
+ * file is there even if the run dies.  olsr-trace-dump prints it.
+ */
+
+olsr_trace_header *g_olsr_trace = NULL;
+static olsr_trace_rec *trace_recs;
+static size_t trace_len;
+
+/**
+ * Create olsr-trace.<rank> holding the last records events of this rank
+ * and start tracing into it
+ */
+void olsr_trace_open(unsigned long records)
+{
+    char name[32];
+    int fd;
+    void *p;
+
+    if (records == 0) return;
+
+    sprintf(name, "olsr-trace.%d", g_tw_mynode);
+    trace_len = sizeof(olsr_trace_header) + records * sizeof(olsr_trace_rec);
+
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        tw_error(TW_LOC, "Failed to open OLSR trace file %s\n", name);
+    }
+    if (ftruncate(fd, trace_len) != 0) {
+        tw_error(TW_LOC, "Failed to size OLSR trace file %s\n", name);
+    }
+    p = mmap(NULL, trace_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        tw_error(TW_LOC, "Failed to map OLSR trace file %s\n", name);
+    }
+    close(fd);
+
+    g_olsr_trace = p;
+    g_olsr_trace->magic = OLSR_TRACE_MAGIC;
+    g_olsr_trace->version = OLSR_TRACE_VERSION;
+    g_olsr_trace->record_size = sizeof(olsr_trace_rec);
+    g_olsr_trace->capacity = records;
+    g_olsr_trace->head = 0;
+    g_olsr_trace->rank = g_tw_mynode;
+    trace_recs = (olsr_trace_rec *)(g_olsr_trace + 1);
+}
+
+/**
+ * Record what just happened to lp.  m is NULL for OLSR_TRACE_INIT.
+ */
+void olsr_trace_event(tw_lp *lp, olsr_msg_data *m, olsr_trace_kind kind)
+{
+    uint64_t i = g_olsr_trace->head++;
+    olsr_trace_rec *r = &trace_recs[i % g_olsr_trace->capacity];
+    int k;
+
+    r->gid = lp->gid;
+    r->ts = tw_now(lp);
+    for (k = 0; k < 4; k++) {
+        r->rng[k] = lp->rng->Cg[k];
+    }
+    r->kind = kind;
+
+    if (m) {
+        r->type = m->type;
+        r->originator = m->originator;
+        r->sender = m->sender;
+        r->target = m->target;
+        r->seq_num = m->seq_num;
+        r->src_rank = m->src_rank;
+    }
+    else {
+        r->type = OLSR_TRACE_NO_TYPE;
+        r->originator = 0;
+        r->sender = 0;
+        r->target = 0;
+        r->seq_num = 0;
+        r->src_rank = g_tw_mynode;
+    }
+}
+
+/** Stop tracing and push the file out */
+void olsr_trace_close(void)
+{
+    if (g_olsr_trace == NULL) return;
+
+    msync(g_olsr_trace, trace_len, MS_SYNC);
+    munmap(g_olsr_trace, trace_len);
+    g_olsr_trace = NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef OLSR_TRACE_H_
+#define OLSR_TRACE_H_
+
+/**
+ * @file
+ * @brief Layout of the binary event trace, see olsr-trace.c
+ *
+ * Only fixed-width types, and nothing from ROSS, so olsr-trace-dump can
+ * read a trace without the rest of the model.
+ *
+ * A trace file is one olsr_trace_header followed by capacity records.
+ * Record i of the run lives in slot i % capacity, so the file always holds
+ * the last capacity records; head says how many were ever written.
+ */
+
+#include <stdint.h>
+
+/// "OLSRTRC1"
+#define OLSR_TRACE_MAGIC 0x3143525452534c4full
+#define OLSR_TRACE_VERSION 1
+
+/// What happened to the LP
+typedef enum {
+    OLSR_TRACE_INIT,     ///< Init handler ran; type is OLSR_TRACE_NO_TYPE
+    OLSR_TRACE_FORWARD,  ///< Forward event handler ran
+    OLSR_TRACE_REVERSE,  ///< Event was rolled back
+    OLSR_TRACE_KINDS,
+} olsr_trace_kind;
+
+/// type of records with no event behind them
+#define OLSR_TRACE_NO_TYPE 0xff
+
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;   ///< sizeof(olsr_trace_rec) of the writer
+    uint64_t capacity;      ///< Record slots after the header
+    uint64_t head;          ///< Records ever written
+    int32_t rank;           ///< Rank that wrote the file
+    uint32_t reserved[7];
+} olsr_trace_header;
+
+/**
+ * One event, 64 bytes.  rng is the LP's CLCG4 state (Cg) as the handler
+ * started for INIT and FORWARD, and as the rollback finished for REVERSE;
+ * the two should match for the same event.
+ */
+typedef struct
+{
+    uint64_t gid;           ///< LP the event ran on
+    double ts;              ///< Its timestamp
+    uint64_t originator;
+    uint64_t sender;
+    uint64_t target;
+    uint32_t rng[4];
+    uint8_t type;           ///< olsr_ev_type
+    uint8_t kind;           ///< olsr_trace_kind
+    uint16_t seq_num;
+    int32_t src_rank;       ///< Rank the event was sent from
+} olsr_trace_rec;
+
+#endif /* OLSR_TRACE_H_ */
@@ -22,14 +22,14 @@
 #define BITNSLOTS(nb) ((nb + CHAR_BIT - 1) / CHAR_BIT)
 
 #include "ross.h"
-
-#define ENABLE_OPTIMISTIC 0
+#include "olsr-trace.h"
 
 /** HELLO message interval */
 #define HELLO_INTERVAL 2
 /** TC message interval */
 #define TC_INTERVAL 5
 #define TOP_HOLD_TIME (3*TC_INTERVAL)
+#define NEIGHB_HOLD_TIME (3*HELLO_INTERVAL)
 #define SA_INTERVAL 10
 #define MASTER_SA_INTERVAL 60
 #define OLSR_DUP_HOLD_TIME 30
@@ -38,18 +38,64 @@
 #define OLSR_MPR_POWER 16     // dbm
 
 
-/** max neighbors (for array implementation) */
+/**
+ * max neighbors (for array implementation), which is also the region size.
+ * Every loop bound, bitset and array in the per-region kernels follows
+ * from it; the build makes one binary per supported size (olsr-j-8 ...
+ * olsr-j-64) and --region picks one at startup.
+ */
+#ifndef OLSR_MAX_NEIGHBORS
 #define OLSR_MAX_NEIGHBORS 16
+#endif
+#if OLSR_MAX_NEIGHBORS != 8 && OLSR_MAX_NEIGHBORS != 16 && \
+    OLSR_MAX_NEIGHBORS != 32 && OLSR_MAX_NEIGHBORS != 64
+#error "OLSR_MAX_NEIGHBORS must be 8, 16, 32 or 64"
+#endif
 #define OLSR_MAX_2_HOP (OLSR_MAX_NEIGHBORS * OLSR_MAX_NEIGHBORS)
-#define OLSR_MAX_TOP_TUPLES (OLSR_MAX_NEIGHBORS * OLSR_MAX_NEIGHBORS)
-#define OLSR_MAX_ROUTES (OLSR_MAX_NEIGHBORS * OLSR_MAX_NEIGHBORS)
 #define OLSR_MAX_DUPES 64
+/** Open-addressed index over dupSet, kept at most half full */
+#define OLSR_DUP_HASH_BITS 7
+#define OLSR_DUP_HASH_SIZE (1 << OLSR_DUP_HASH_BITS)
+/** No dupSet slot (empty hash bucket, end of the free list) */
+#define OLSR_DUP_NONE 0xff
+#if OLSR_MAX_DUPES >= OLSR_DUP_NONE || 2 * OLSR_MAX_DUPES > OLSR_DUP_HASH_SIZE
+#error "OLSR_DUP_HASH_SIZE must be at least twice OLSR_MAX_DUPES"
+#endif
+
+/** One-second slots in the tuple expiry wheel; must outlast every hold time */
+#define OLSR_WHEEL_SLOTS 32
+#if TOP_HOLD_TIME + 2 > OLSR_WHEEL_SLOTS || NEIGHB_HOLD_TIME + 2 > OLSR_WHEEL_SLOTS
+#error "OLSR_WHEEL_SLOTS is too small for the hold times"
+#endif
+
+/** One bit per node of a region, indexed by address % OLSR_MAX_NEIGHBORS */
+#if OLSR_MAX_NEIGHBORS <= 32
+typedef uint32_t olsr_mask;
+#define olsr_popcount(m) __builtin_popcount(m)
+#define olsr_ctz(m) __builtin_ctz(m)
+#else
+typedef uint64_t olsr_mask;
+#define olsr_popcount(m) __builtin_popcountll(m)
+#define olsr_ctz(m) __builtin_ctzll(m)
+#endif
+#define OLSR_MASK_BIT(i) ((olsr_mask)1 << (i))
 
 /** For Situational Awareness (SA) */
 #define MASTER_NODE ((s->local_address / OLSR_MAX_NEIGHBORS) * OLSR_MAX_NEIGHBORS)
 //#define MASTER_NODE ((s->local_address == 0) ? 0 : (OLSR_MAX_NEIGHBORS / s->local_address))
 
 typedef tw_lpid o_addr; /**< We'll use this as a place holder for addresses */
+/**
+ * Address of a node relative to its region, 0..OLSR_MAX_NEIGHBORS-1.
+ * Everything a node stores, and the address lists in HELLO and TC
+ * messages, refer only to nodes of the same region, so they use these;
+ * o_addr is only needed where an LP is named (event targets, message
+ * headers, output).
+ */
+typedef uint16_t o_local;
+#define OLSR_LOCAL(a) ((o_local)((a) % OLSR_MAX_NEIGHBORS))
+/** Global address of the node l of the region containing address a */
+#define OLSR_GLOBAL(a, l) ((a) - (a) % OLSR_MAX_NEIGHBORS + (l))
 typedef double Time;    /**< Use a double for time, check w/ Chris */
 typedef enum {
     HELLO_RX,
@@ -65,6 +111,12 @@ typedef enum {
 } olsr_ev_type;
 
 extern char *event_names[];
+
+/**
+ * Size of the buffer behind a short TWOPT_CHAR option.  ROSS strcpy()s the
+ * whole argument, so olsr-j checks it fits before tw_init().
+ */
+#define OLSR_OPT_LEN 16
 //= {
 //    "HELLO_RX",
 //    "HELLO_TX",
@@ -114,11 +166,10 @@ struct Hello
 typedef struct /* Hello */
 {
     /* No support for link codes yet! */
-    char is_mpr[OLSR_MAX_NEIGHBORS];
-    /** Addresses of our neighbors */
-    o_addr neighbor_addrs[OLSR_MAX_NEIGHBORS];
-    /** Number of neighbors, 0..n-1 */
-    unsigned num_neighbors;
+    /** Our neighbors, one bit per region-local address */
+    olsr_mask neighbors;
+    /** The neighbors we have chosen as MPRs, a subset of neighbors */
+    olsr_mask mprs;
     
     /** HELLO emission interval */
     uint8_t hTime;
@@ -149,7 +200,8 @@ struct Tc
 typedef struct /* Tc */
 {
     uint16_t ansn;
-    o_addr neighborAddresses[OLSR_MAX_TOP_TUPLES];
+    /** Our neighbor set, so never more than a region's worth */
+    o_local neighborAddresses[OLSR_MAX_NEIGHBORS];
     unsigned num_neighbors;
 } TC;
 
@@ -182,7 +234,7 @@ typedef struct /* LinkTuple */
 typedef struct /* NeighborTuple */
 {
     /// Main address of a neighbor node.
-    o_addr neighborMainAddr;
+    o_local neighborMainAddr;
     /// Neighbor Type and Link Type at the four less significative digits.
     enum Status {
         STATUS_NOT_SYM = 0, // "not symmetric"
@@ -190,43 +242,54 @@ typedef struct /* NeighborTuple */
     } status;
     /// A value between 0 and 7 specifying the node's willingness to carry traffic on behalf of other nodes.
     uint8_t willingness;
+    /// Time at which this tuple expires and must be removed.
+    Time expirationTime;
 } neigh_tuple;
 
-typedef struct /* TwoHopNeighborTuple */
+/**
+ * The 2-hop neighbor set (TwoHopNeighborTuples), one array per field so
+ * scans over the addresses don't pull the expiration times into cache
+ */
+typedef struct /* TwoHopNeighborSet */
 {
     /// Main address of a neighbor.
-    o_addr neighborMainAddr;
+    o_local neighborMainAddr[OLSR_MAX_2_HOP];
     /// Main address of a 2-hop neighbor with a symmetric link to nb_main_addr.
-    o_addr twoHopNeighborAddr;
+    o_local twoHopNeighborAddr[OLSR_MAX_2_HOP];
     /// Time at which this tuple expires and must be removed.
-    Time expirationTime; // previously called 'time_'
-} two_hop_neigh_tuple;
+    Time expirationTime[OLSR_MAX_2_HOP]; // previously called 'time_'
+} two_hop_neigh_set;
 
 typedef struct /* MprSelectorTuple */
 {
     /// Main address of a node which have selected this node as a MPR.
-    o_addr mainAddr;
+    o_local mainAddr;
     /// Time at which this tuple expires and must be removed.
     // Time expirationTime; // previously called 'time_'
 } mpr_sel_tuple;
 
-typedef struct /* TopologyTuple */
+/**
+ * The topology set (TopologyTuples) as an adjacency bit-matrix, one row per
+ * T_last_addr.  Every tuple a TC message leaves behind carries that
+ * message's ANSN, and the same ANSN always advertises the same neighbors,
+ * so the tuples of a row share one sequence number and holding time.  A
+ * row with no bits set holds no tuples and the rest of it is unused.
+ */
+typedef struct /* TopologySet */
 {
-    /// Main address of the destination.
-    o_addr destAddr;
-    /// Main address of a node which is a neighbor of the destination.
-    o_addr lastAddr;
-    /// Sequence number.
-    uint16_t sequenceNumber;
-    /// Time at which this tuple expires and must be removed.
-    Time expirationTime;
-} top_tuple;
+    /// Indexed by T_last_addr, the T_dest_addrs it is a neighbor of.
+    olsr_mask destAddr[OLSR_MAX_NEIGHBORS];
+    /// Sequence number of each row.
+    uint16_t sequenceNumber[OLSR_MAX_NEIGHBORS];
+    /// Time at which each row expires and must be removed.
+    Time expirationTime[OLSR_MAX_NEIGHBORS];
+} top_set;
 
 /// An OLSR's routing table entry.
 typedef struct /* RoutingTableEntry */
 {
-    o_addr destAddr; ///< Address of the destination node.
-    o_addr nextAddr; ///< Address of the next hop.
+    o_local destAddr; ///< Address of the destination node.
+    o_local nextAddr; ///< Address of the next hop.
     // Only one interface in our model
     //uint32_t interface; ///< Interface index
     uint32_t distance; ///< Distance in hops to the destination.
@@ -236,7 +299,7 @@ typedef struct /* RoutingTableEntry */
 typedef struct /* DuplicateTuple */
 {
     /// Originator address of the message.
-    o_addr address;
+    o_local address;
     /// Message sequence number.
     uint16_t sequenceNumber;
     /// Indicates whether the message has been retransmitted or not.
@@ -245,8 +308,20 @@ typedef struct /* DuplicateTuple */
     // std::vector<Ipv4Address> ifaceList;
     /// Time at which this tuple expires and must be removed.
     Time expirationTime;
+    /// Neighbors in the expiry ring; next also links the free slots
+    uint8_t prev;
+    uint8_t next;
 } dup_tuple;
 
+/// One second of the tuple expiry wheel
+typedef struct
+{
+    /// Groups with something that may expire during second
+    olsr_mask due;
+    /// The second due is for; a slot is reused once the wheel comes round
+    unsigned long second;
+} wheel_slot;
+
 /**
  This struct contains all of the OLSR per-node state.  Not everything in the
  ns3 class is necessary or implemented, but here is the ns3 OlsrState class:
@@ -270,6 +345,111 @@ protected:
  @endcode
  */
 
+/**
+ * Time events spend in their handlers, and in the costly parts of them,
+ * per olsr_ev_type.  Two clock reads per timed part add up over millions
+ * of events, so it is off unless built with -DOLSR_TIMING=1
+ * (olsr-j-timing).
+ */
+#ifndef OLSR_TIMING
+#define OLSR_TIMING 0
+#endif
+
+typedef enum {
+    OLSR_COST_HANDLER,  ///< The whole forward handler
+    OLSR_COST_MPR,      ///< MprComputation()
+    OLSR_COST_ROUTES,   ///< RoutingTableComputation()
+    OLSR_COST_DUPS,     ///< Duplicate set lookups and updates
+    OLSR_COSTS,
+} olsr_cost;
+
+/** Kinds of LP an event can travel between */
+typedef enum {
+    OLSR_PAIR_NODE_NODE,        ///< HELLO, TC, SA and self-scheduled events
+    OLSR_PAIR_NODE_MASTER,      ///< Level 0 SA_MASTER_RX
+    OLSR_PAIR_MASTER_MASTER,    ///< SA_MASTER_RX up the hierarchy
+    OLSR_PAIRS,
+} olsr_pair;
+
+/** Levels of the SA master hierarchy counted separately; deeper ones share the last */
+#define OLSR_MAX_LEVELS 32
+
+/**
+ * The model's counters on this PE, reduced over every rank once tw_run()
+ * has returned
+ */
+typedef struct olsr_stats
+{
+    /// Events processed (net of rollbacks), per olsr_ev_type
+    unsigned long long events[OLSR_END_EVENT];
+    /// Of those, the ones sent from another rank
+    unsigned long long remote[OLSR_END_EVENT];
+    /// Events processed, and those from another rank, per olsr_pair
+    unsigned long long pair_events[OLSR_PAIRS];
+    unsigned long long pair_remote[OLSR_PAIRS];
+    /// SA_MASTER_RX events processed, and those from another rank, per level
+    unsigned long long level_events[OLSR_MAX_LEVELS];
+    unsigned long long level_remote[OLSR_MAX_LEVELS];
+    /// Times the MPR set was rebuilt, at most once per HELLO_TX
+    unsigned long long mpr_computed;
+    /// Rebuilds avoided next to rebuilding on every HELLO_RX heard: those
+    /// that changed neither set, or changed them while the MPR set was
+    /// already waiting for a rebuild
+    unsigned long long mpr_avoided;
+    /// Bytes ever written to delta logs
+    unsigned long long delta_bytes;
+    /// Delta log segments ever opened
+    unsigned long long delta_segments;
+    /// Most events this PE's pool has had in use at once, pending or kept
+    /// for rollback, as seen at the start of each event
+    unsigned long long events_peak;
+#if OLSR_TIMING
+    /// Nanoseconds spent on each olsr_cost by events of each type,
+    /// whether or not they were rolled back later
+    unsigned long long cost_ns[OLSR_COSTS][OLSR_END_EVENT];
+    /// Type of the event whose handler is running
+    olsr_ev_type cost_type;
+#endif
+} olsr_stats;
+
+extern olsr_stats g_olsr_stats;
+
+#if OLSR_TIMING
+#include <time.h>
+
+static inline unsigned long long olsr_clock_ns(void)
+{
+    struct timespec t;
+    
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/// Start timing something, into a local named t
+#define OLSR_TIME_BEGIN(t) unsigned long long t = olsr_clock_ns()
+/// Charge the time since OLSR_TIME_BEGIN(t) to cost c of the running event
+#define OLSR_TIME_END(t, c) \
+    (g_olsr_stats.cost_ns[c][g_olsr_stats.cost_type] += olsr_clock_ns() - (t))
+#else
+#define OLSR_TIME_BEGIN(t) do {} while (0)
+#define OLSR_TIME_END(t, c) do {} while (0)
+#endif
+
+/**
+ * How optimistic runs roll events back.  By default every event saves what
+ * it overwrites in a per-LP delta log (olsr-delta.c).  Build with
+ * -DOLSR_REVERSE=1 (olsr-j-reverse) to reverse compute instead: events
+ * leave tw_bf bits and a small undo record in their message, and removed
+ * tuples are swapped past the end of their set so they can be swapped
+ * back.
+ */
+#ifndef OLSR_REVERSE
+#define OLSR_REVERSE 0
+#endif
+
+/// Per-LP log of overwritten state, see olsr-delta.c
+typedef struct olsr_delta_log olsr_delta_log;
+
 typedef struct /*OlsrState */
 {
     /// Longitude for this node only
@@ -286,38 +466,188 @@ typedef struct /*OlsrState */
     // vector<NeighborTuple>
     neigh_tuple neighSet[OLSR_MAX_NEIGHBORS];
     unsigned num_neigh;
+    // The addresses in neighSet
+    olsr_mask neigh_mask;
     // vector<TwoHopNeighborTuple>
-    two_hop_neigh_tuple twoHopSet[OLSR_MAX_2_HOP];
+    two_hop_neigh_set twoHopSet;
     unsigned num_two_hop;
+    // Indexed by neighbor, the 2-hop neighbors in twoHopSet through it
+    olsr_mask two_hop_mask[OLSR_MAX_NEIGHBORS];
     // set<Ipv4Address>
-    o_addr mprSet[OLSR_MAX_NEIGHBORS];
+    o_local mprSet[OLSR_MAX_NEIGHBORS];
     unsigned num_mpr;
+    // The addresses in mprSet
+    olsr_mask mpr_mask;
+    /// mprSet is stale, rebuild it before it is next advertised
+    uint8_t mpr_dirty;
     // vector<MprSelectorTuple>
     mpr_sel_tuple mprSelSet[OLSR_MAX_NEIGHBORS];
     unsigned num_mpr_sel;
     // vector<TopologyTuple>
-    top_tuple topSet[OLSR_MAX_TOP_TUPLES];
-    unsigned num_top_set;
-    // vector<RoutingTableEntry>
-    RT_entry route_table[OLSR_MAX_ROUTES];
-    unsigned num_routes;
+    top_set topSet;
+    // Indexed by region-local address, route_valid says which are set
+    RT_entry route_table[OLSR_MAX_NEIGHBORS];
+    olsr_mask route_valid;
+    /// route_table is stale, rebuild it before the next Lookup()
+    uint8_t routes_dirty;
+    /// Expiry wheel: per second, which neighbors, whose 2-hop tuples and
+    /// whose topology tuples may expire during it (see expire_tuples())
+    wheel_slot wheel_neigh[OLSR_WHEEL_SLOTS];
+    wheel_slot wheel_two_hop[OLSR_WHEEL_SLOTS];
+    wheel_slot wheel_top[OLSR_WHEEL_SLOTS];
+    /// First second the wheel has not swept yet
+    unsigned long wheel_next;
     // vector<DuplicateTuple>
+    /// Slots are handed out from a free list, so live tuples are not packed
     dup_tuple dupSet[OLSR_MAX_DUPES];
     unsigned num_dupes;
+    /// dupSet slot of each (originator, sequence number), linear probing
+    uint8_t dup_hash[OLSR_DUP_HASH_SIZE];
+    /// Soonest to expire; the ring runs in expiry order from here
+    uint8_t dup_oldest;
+    /// First unused dupSet slot
+    uint8_t dup_free;
     
     // Not part of the state in ns3 but fits here mostly
     uint16_t ansn;
+    /// Sequence number of the last TC this node originated, what
+    /// FindDuplicateTuple() tells copies of a TC apart by
+    uint16_t msg_seq;
     int SA_per_node[OLSR_MAX_NEIGHBORS];
     
+    /// Undo log for optimistic runs, NULL otherwise
+    olsr_delta_log *delta;
+#if OLSR_REVERSE
+    /// Where each tuple past the end of its set was swapped from
+    uint8_t neigh_from[OLSR_MAX_NEIGHBORS];
+    uint16_t two_hop_from[OLSR_MAX_2_HOP];
+    uint8_t mpr_sel_from[OLSR_MAX_NEIGHBORS];
+    /// Each topology row as it was when last removed
+    olsr_mask top_removed[OLSR_MAX_NEIGHBORS];
+#endif
 } node_state;
 
+/**
+ * Scratch space for one MprComputation(), indexed like neighSet.  Nothing
+ * in it outlives the call.
+ */
+typedef struct
+{
+    /// D(y) of each neighbor
+    unsigned Dy[OLSR_MAX_NEIGHBORS];
+    /// Members of N2 reachable through each neighbor
+    olsr_mask coverage[OLSR_MAX_NEIGHBORS];
+} olsr_mpr_scratch;
+
+void MprComputation(node_state *s, olsr_mpr_scratch *w);
+
+/**
+ * Scratch space for MprComputationGreedy(): its own copy of N2, which it
+ * whittles down as 2-hop neighbors get covered
+ */
+typedef struct
+{
+    unsigned num_two_hop;
+    o_local neighborMainAddr[OLSR_MAX_2_HOP];
+    o_local twoHopNeighborAddr[OLSR_MAX_2_HOP];
+    /// D(y) of each neighbor, indexed like neighSet
+    unsigned Dy[OLSR_MAX_NEIGHBORS];
+} olsr_mpr_greedy_scratch;
+
+void MprComputationGreedy(node_state *s, olsr_mpr_greedy_scratch *w);
+
+/*
+ * The per-node kernels, callable on any node_state without ROSS running
+ * (see olsr-bench.c)
+ */
+void olsr_state_clear(node_state *s);
+void RoutingTableComputation(node_state *s);
+unsigned Dy(node_state *s, o_local target);
+dup_tuple * FindDuplicateTuple(o_local addr, uint16_t seq_num, node_state *s);
+void AddDuplicate(o_local originator, uint16_t seq_num, Time ts,
+                  int retransmitted, node_state *s, Time now);
+void EraseOlderTopologyTuples(o_local last, uint16_t ansn, node_state *s);
+
+/**
+ * Every event carries the largest of these, so keep them to what a
+ * message can actually hold
+ */
 union message_type {
     hello h;
     TC t;
     latlng l;
-    latlng_cluster llc;
+    //latlng_cluster llc;
 };
 
+#if OLSR_REVERSE
+/**
+ * What expire_tuples() removed.  Removed tuples sit past the end of their
+ * set, so how many went is enough to swap them back.
+ */
+typedef struct
+{
+    /// s->wheel_next before the sweep
+    unsigned long wheel_next;
+    /// Topology rows removed, see top_removed
+    olsr_mask top;
+    uint16_t num_two_hop;
+    uint8_t num_neigh;
+    uint8_t num_mpr_sel;
+} expire_undo;
+
+/// A 2-hop tuple HELLO_RX refreshed (old expirationTime) or overwrote
+typedef struct
+{
+    o_local neighborMainAddr;
+    o_local twoHopNeighborAddr;
+    uint16_t from;
+    Time expirationTime;
+} two_hop_undo;
+
+/// What HELLO_RX overwrote
+typedef struct
+{
+    /// The neighbor tuple refreshed, or the slot appended to
+    neigh_tuple neigh;
+    uint8_t neigh_from;
+    /// The MPR selector slot appended to
+    uint8_t mpr_sel_from;
+    mpr_sel_tuple mpr_sel;
+    /// s->two_hop_mask[originator]
+    olsr_mask two_hop_mask;
+    /// The neighbor and 2-hop wheel slots written
+    wheel_slot wheel[2];
+    /// Indexed by 2-hop neighbor, the tuple refreshed or slot appended to
+    two_hop_undo two_hop[OLSR_MAX_NEIGHBORS];
+} hello_undo;
+
+/// What TC_RX overwrote
+typedef struct
+{
+    /// The originator's topology row
+    olsr_mask destAddr;
+    olsr_mask top_removed;
+    uint16_t sequenceNumber;
+    Time expirationTime;
+    wheel_slot wheel;
+    /// The duplicate tuple refreshed, or the free slot added to
+    dup_tuple dup;
+    uint8_t dup_oldest;
+    /// Tuples AddDuplicate() expired or evicted first
+    uint8_t dup_removed;
+} tc_undo;
+
+/// What an event overwrote in node_state, for olsr_event_reverse()
+typedef struct
+{
+    expire_undo expire;
+    union {
+        hello_undo hello;
+        tc_undo tc;
+    } rx;
+} olsr_undo;
+#endif
+
 typedef struct
 {
     olsr_ev_type type;     ///< What type of message is this?
@@ -331,11 +661,42 @@ typedef struct
     unsigned long target;  ///< Target index into g_tw_lp
     uint16_t seq_num;      ///< Sequence number for this message
     int level;             ///< Level for SA_MASTER messages
-#if ENABLE_OPTIMISTIC
-    node_state state_copy;  ///< copy state for the lp that processes the event
-#endif 
+    unsigned long delta;   ///< Where the receiver's saved state starts
+    int src_rank;          ///< Rank that sent this message
+#if OLSR_REVERSE
+    olsr_undo undo;        ///< Filled in by the receiver for rollback
+#endif
 } olsr_msg_data;
 
+olsr_delta_log * olsr_delta_new(void);
+void olsr_delta_begin(node_state *s, olsr_msg_data *m, tw_lp *lp);
+void olsr_delta_save(node_state *s, void *field, size_t len);
+void olsr_delta_rollback(node_state *s, olsr_msg_data *m);
+
+#if OLSR_REVERSE
+#define OLSR_SAVE(s, member) do {} while (0)
+/// Run the statements only when reverse computing, to fill in m->undo
+#define OLSR_UNDO(...) do { __VA_ARGS__; } while (0)
+#else
+/// Save a node_state member before overwriting it
+#define OLSR_SAVE(s, member) olsr_delta_save((s), &(member), sizeof(member))
+#define OLSR_UNDO(...) do {} while (0)
+#endif
+
+/// Mapped trace file of this rank, NULL unless --trace asked for one
+extern olsr_trace_header *g_olsr_trace;
+void olsr_trace_open(unsigned long records);
+void olsr_trace_event(tw_lp *lp, olsr_msg_data *m, olsr_trace_kind kind);
+void olsr_trace_close(void);
+
+/// Add a record to the event trace, if it is on
+#define OLSR_TRACE(lp, m, kind) \
+    do { if (g_olsr_trace) olsr_trace_event((lp), (m), (kind)); } while (0)
+
+int out_of_radio_range(node_state *s, olsr_msg_data *m);
+olsr_mask region_grid_in_range(o_addr sender, double lng, double lat);
+void region_grid_place(o_addr a, double lng, double lat);
+
 void olsr_custom_mapping(void);
 tw_lp * olsr_mapping_to_lp(tw_lpid lpid);
 